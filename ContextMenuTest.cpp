@@ -5,370 +5,164 @@
 
 #include "framework.h"
 #include "ContextMenuTest.h"
+#include "MenuEngine.h"
+#include "MenuClip.h"
+#include "MenuPaint.h"
+#include "MenuScene.h"
+#include "MenuEngineInput.h"
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <optional>
 #include <string>
-#include <utility>
 #include <vector>
 #include <stdio.h>
-#include <stdint.h>
-#include <math.h>
-
-struct params_t {
-    float initial_radius = 200.0f;
-    float sector_edge_slope = 0.3f;
-    float branch_near_edge_offset = 100.0f;
-    float branch_far_edge_offset = 100.0f;
-    float branch_far_edge_dead_zone = 150.0f;
-    float branch_label_length_offset = 300.0f;
-    float branch_label_height_offset = 50.0f;
-    float leaf_base_offset = 150.0f;
-    float leaf_height = 400.0f;
-    int min_window_margin = 200;
-};
-params_t params;
-float const display_scale = 0.2f;
-
-float const sqrt_1_2 = 0.70710678f;
-float const tan_pi_8 = 0.41421356f;
-
-struct action_t {
-    std::wstring name;
-};
-
-struct menu_item_t {
-    struct submenu_t;
-    std::wstring description;
-    std::unique_ptr<submenu_t> submenu;
-    std::optional<action_t> opt_action;
 
-    static menu_item_t branch(std::wstring descr, menu_item_t ia, menu_item_t ib);
-    static menu_item_t leaf(std::wstring descr);
-};
-
-struct menu_item_t::submenu_t {
-    menu_item_t left;
-    menu_item_t right;
-
-    static std::unique_ptr<submenu_t> make(menu_item_t ia, menu_item_t ib) {
-        return std::make_unique<submenu_t>(submenu_t{std::move(ia), std::move(ib)});
-    }
-};
+menu_rcu_t menu_rcu;
 
-menu_item_t menu_item_t::branch(std::wstring descr, menu_item_t ia, menu_item_t ib) {
-    return menu_item_t{std::move(descr) + L"...", submenu_t::make(std::move(ia), std::move(ib))};
-}
-
-menu_item_t menu_item_t::leaf(std::wstring descr) {
-    std::wstring d2 = descr;
-    return menu_item_t{std::move(descr), nullptr, action_t{std::move(d2)}};
-}
-
-menu_item_t menu[8] = {
-    menu_item_t::branch(
-        L"6",
-        menu_item_t::branch(
-            L"6U",
-            menu_item_t::leaf(L"6UL"),
-            menu_item_t::leaf(L"6UR")),
+std::unique_ptr<menu_tree_t> make_default_menu() {
+    return std::make_unique<menu_tree_t>(menu_tree_t{{
         menu_item_t::branch(
-            L"6D",
-            menu_item_t::leaf(L"6DR"),
-            menu_item_t::leaf(L"6DL"))),
-    menu_item_t::branch(
-        L"3",
-        menu_item_t::branch(
-            L"3U",
+            L"6",
             menu_item_t::branch(
-                L"3UL",
-                menu_item_t::leaf(L"3ULD"),
-                menu_item_t::leaf(L"3ULU")),
+                L"6U",
+                menu_item_t::leaf(L"6UL"),
+                menu_item_t::leaf(L"6UR")),
             menu_item_t::branch(
-                L"3UR",
-                menu_item_t::leaf(L"3URU"),
-                menu_item_t::leaf(L"3URD"))),
-        menu_item_t::branch(
-            L"3L",
-            menu_item_t::leaf(L"3LD"),
-            menu_item_t::leaf(L"3LU"))),
-    menu_item_t{L"<legacy here>"},
-    menu_item_t::branch(
-        L"1",
-        menu_item_t::leaf(L"1R"),
-        menu_item_t::leaf(L"1U")),
-    menu_item_t::branch(
-        L"4",
+                L"6D",
+                menu_item_t::leaf(L"6DR"),
+                menu_item_t::leaf(L"6DL"))),
         menu_item_t::branch(
-            L"4D",
-            menu_item_t::leaf(L"4DR"),
-            menu_item_t::leaf(L"4DL")),
+            L"3",
+            menu_item_t::branch(
+                L"3U",
+                menu_item_t::branch(
+                    L"3UL",
+                    menu_item_t::leaf(L"3ULD"),
+                    menu_item_t::leaf(L"3ULU")),
+                menu_item_t::branch(
+                    L"3UR",
+                    menu_item_t::leaf(L"3URU"),
+                    menu_item_t::leaf(L"3URD"))),
+            menu_item_t::branch(
+                L"3L",
+                menu_item_t::leaf(L"3LD"),
+                menu_item_t::leaf(L"3LU"))),
+        menu_item_t{L"<legacy here>"},
         menu_item_t::branch(
-            L"4U",
-            menu_item_t::leaf(L"4UL"),
-            menu_item_t::leaf(L"4UR"))),
-    menu_item_t::branch(
-        L"7",
+            L"1",
+            menu_item_t::leaf(L"1R"),
+            menu_item_t::leaf(L"1U")),
         menu_item_t::branch(
-            L"7D",
-            menu_item_t::leaf(L"7DR"),
-            menu_item_t::leaf(L"7DL")),
+            L"4",
+            menu_item_t::branch(
+                L"4D",
+                menu_item_t::leaf(L"4DR"),
+                menu_item_t::leaf(L"4DL")),
+            menu_item_t::branch(
+                L"4U",
+                menu_item_t::leaf(L"4UL"),
+                menu_item_t::leaf(L"4UR"))),
         menu_item_t::branch(
-            L"7R",
-            menu_item_t::leaf(L"7RU"),
-            menu_item_t::leaf(L"7RD"))),
-    menu_item_t{L"<legacy here>"},
-    menu_item_t::leaf(L"9"),
-};
-
-enum class rotor: uint_fast8_t;
-
-rotor operator~(rotor a) {
-    return rotor(-(uint_fast8_t)a);
-}
-
-rotor operator+(rotor a, rotor b) {
-    return rotor((uint_fast8_t)a + (uint_fast8_t)b);
-}
-
-uint_fast8_t operator+(rotor a) {
-    return (uint_fast8_t)a & 7;
-}
-
-struct vec2 {
-    float x, y;
-
-    vec2 rotp90() const {
-        return vec2{y, -x};
-    }
-
-    vec2 rotm90() const {
-        return vec2{-y, x};
-    }
-
-    vec2& operator+=(vec2 b) {
-        x += b.x;
-        y += b.y;
-        return *this;
-    }
-};
-
-vec2 operator-(vec2 a) {
-    return vec2{-a.x, -a.y};
-}
-
-vec2 operator~(vec2 a) {
-    return vec2{a.x, -a.y};
-}
-
-vec2 operator+(vec2 a, vec2 b) {
-    return vec2{a.x + b.x, a.y + b.y};
-}
-
-vec2 operator-(vec2 a, vec2 b) {
-    return vec2{a.x - b.x, a.y - b.y};
-}
-
-vec2 operator*(float a, vec2 b) {
-    return vec2{a * b.x, a * b.y};
+            L"7",
+            menu_item_t::branch(
+                L"7D",
+                menu_item_t::leaf(L"7DR"),
+                menu_item_t::leaf(L"7DL")),
+            menu_item_t::branch(
+                L"7R",
+                menu_item_t::leaf(L"7RU"),
+                menu_item_t::leaf(L"7RD"))),
+        menu_item_t{L"<legacy here>"},
+        menu_item_t::leaf(L"9"),
+    }});
 }
 
-vec2 operator%(rotor a, vec2 b) {
-    uint8_t ai = (uint8_t)a;
-    float rx = b.x;
-    float ry = b.y;
-    if (ai & 4) {
-        rx = -rx;
-        ry = -ry;
-    }
-    if (ai & 2) {
-        float orx = rx;
-        float ory = ry;
-        rx = -ory;
-        ry = orx;
-    }
-    if (ai & 1) {
-        float orx = rx;
-        float ory = ry;
-        rx = sqrt_1_2 * orx - sqrt_1_2 * ory;
-        ry = sqrt_1_2 * orx + sqrt_1_2 * ory;
+menu_state_t menu_state;
+enum class Mode {
+    Disabled,
+    Pressed,
+    PressedAgain,
+    Clicked,
+} mode;
+POINT center_point;
+menu_rcu_t::reader_t* menu_reader;
+std::optional<action_t> last_selected_action;
+std::chrono::steady_clock::time_point session_start_time;
+int const relayout_interval = 20;
+size_t const relayout_max_moves = 1;
+float const relayout_min_count_ratio = 2.0f;
+int selections_since_relayout;
+
+/*
+    Re-layout runs on a thread of its own, woken by relayout_event every
+    relayout_interval selections, so that cloning and ranking the tree never
+    delays the button-up that finishes a selection. It works on a clone of
+    the current tree, not of the one the last session pinned, and drops its
+    result if another tree was published meanwhile; the next wake-up starts
+    over from that tree.
+*/
+HANDLE relayout_event;
+menu_rcu_t::reader_t* relayout_reader;
+std::vector<paint_command_t> paint_commands;
+paint_batch_t paint_batch;
+std::vector<POINT> paint_points;
+
+/*
+    Runs a paint_batch_t on a device context.
+*/
+struct gdi_paint_backend_t {
+    HDC dc;
+
+    void pen(uintptr_t style) {
+        SelectObject(dc, (HPEN)style);
     }
-    return vec2{rx, ry};
-}
 
-struct menu_state_t {
-    struct branch_t {
-        menu_item_t* menu_item_ptr;
-        vec2 origin;
-        rotor rot;
-        float base_slope;
-        float top_offset;
-        float bot_offset;
-        float trigger_offset;
-        bool top_active;
-        bool bot_active;
-    };
-
-    vec2 global_pos;
-    std::vector<branch_t> branches;
-
-    void reset() {
-        global_pos = vec2{0, 0};
-        branches.resize(0);
+    void text_color(uintptr_t style) {
+        SetTextColor(dc, (COLORREF)style);
     }
 
-    void find_sector(rotor& out_rot, vec2& out_pos) {
-        int side = 0;
-        float x = global_pos.x;
-        float y = global_pos.y;
-        float a = sqrt_1_2 * (x + y);
-        float b = sqrt_1_2 * (- x + y);
-        if (x < -b) {
-            side = 4;
-            x = -x;
-            y = -y;
-            a = -a;
-            b = -b;
-        }
-        if (x < b) {
-            side += 2;
-            float ox = x;
-            float oy = y;
-            float oa = a;
-            float ob = b;
-            x = oy;
-            y = -ox;
-            a = ob;
-            b = -oa;
-        }
-        if (x < a) {
-            out_rot = rotor(side + 1);
-            out_pos = vec2{a, b};
-        } else {
-            out_rot = rotor(side);
-            out_pos = vec2{x, y};
-        }
+    void font(uintptr_t font) {
+        SelectObject(dc, (HFONT)font);
     }
 
-    void apply_delta(vec2 delta) {
-        global_pos += delta;
-    update:
-        if (branches.size() == 0) {
-            rotor rot;
-            vec2 relpos;
-            find_sector(rot, relpos);
-            if (relpos.x > params.initial_radius) {
-                vec2 origin = rot % vec2{params.initial_radius, 0};
-                branches.push_back(branch_t{
-                    &menu[+rot],
-                    origin,
-                    rot,
-                    0,
-                    params.initial_radius * tan_pi_8,
-                    params.initial_radius * tan_pi_8,
-                    0,
-                    true,
-                    true});
-                goto update;
-            }
-        } else {
-            branch_t& branch = branches.back();
-            vec2 pos = ~branch.rot % (global_pos - branch.origin);
-            if (pos.x < pos.y * branch.base_slope) {
-                branches.pop_back();
-                goto update;
-            }
-            float trigger_distance = pos.x - pos.y * branch.base_slope;
-            if (!branch.top_active) {
-                if (trigger_distance > branch.trigger_offset) {
-                    branch.top_active = true;
-                    float y_distance = branch.top_offset + params.sector_edge_slope * pos.x + pos.y;
-                    if (y_distance < branch.top_offset) {
-                        branch.top_offset += branch.top_offset - y_distance;
-                    }
-                }
-            }
-            if (!branch.bot_active) {
-                if (trigger_distance > branch.trigger_offset) {
-                    branch.bot_active = true;
-                    float y_distance = branch.bot_offset + params.sector_edge_slope * pos.x - pos.y;
-                    if (y_distance < branch.bot_offset) {
-                        branch.bot_offset += branch.bot_offset - y_distance;
-                    }
-                }
-            }
-            if (branch.menu_item_ptr->submenu) {
-                if (branch.top_active) {
-                    float ylim = branch.top_offset + params.sector_edge_slope * pos.x;
-                    if (pos.y < -ylim) {
-                        branch.bot_active = true;
-                        branches.push_back(branch_t{
-                            &branch.menu_item_ptr->submenu->left,
-                            branch.origin + branch.rot % vec2{pos.x, -ylim},
-                            branch.rot + rotor(6),
-                            params.sector_edge_slope,
-                            params.branch_near_edge_offset,
-                            params.branch_far_edge_offset,
-                            params.branch_far_edge_dead_zone,
-                            false,
-                            false});
-                        goto update;
-                    }
-                }
-                if (branch.bot_active) {
-                    float ylim = branch.bot_offset + params.sector_edge_slope * pos.x;
-                    if (pos.y > ylim) {
-                        branch.top_active = true;
-                        branches.push_back(branch_t{
-                            &branch.menu_item_ptr->submenu->right,
-                            branch.origin + branch.rot % vec2{pos.x, ylim},
-                            branch.rot + rotor(2),
-                            -params.sector_edge_slope,
-                            params.branch_far_edge_offset,
-                            params.branch_near_edge_offset,
-                            params.branch_far_edge_dead_zone,
-                            false,
-                            false});
-                        goto update;
-                    }
-                }
-            }
+    void polyline(vec2 const* points, uint32_t count) {
+        paint_points.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            paint_points[i] = POINT{(LONG)lroundf(points[i].x), (LONG)lroundf(points[i].y)};
         }
+        Polyline(dc, paint_points.data(), (int)count);
     }
 
-    menu_item_t* selected_leaf_item() {
-        if (branches.size() == 0) {
-            return nullptr;
-        } else {
-            return branches.back().menu_item_ptr;
-        }
+    void label(paint_command_t const& command) {
+        TextOutW(dc, (int)command.a.x, (int)command.a.y, command.text->data(), (int)command.text->size());
     }
 };
 
-vec2 text_delta_table[8] = {
-    vec2{ 0.0f, -0.5f},
-    vec2{ 0.0f,  0.0f},
-    vec2{-0.5f,  0.0f},
-    vec2{-1.0f,  0.0f},
-    vec2{-1.0f, -0.5f},
-    vec2{-1.0f, -1.0f},
-    vec2{-0.5f, -1.0f},
-    vec2{ 0.0f, -1.0f},
-};
-
-menu_state_t menu_state;
-enum class Mode {
-    Disabled,
-    Pressed,
-    PressedAgain,
-    Clicked,
-} mode;
-POINT center_point;
-action_t* last_selected_action;
+/*
+    The mouse is read as raw input on a thread of its own, which only
+    stamps the deltas and button transitions and queues them. WndProc
+    handles them when it drains input_queue on WM_APP_INPUT, so a long
+    paint or a modal loop such as the About box delays the handling but
+    not the stamps, and no input is lost up to the capacity of the queue.
+    input_wake_pending keeps the input thread from posting more than one
+    WM_APP_INPUT per drain. While events are pending in the queue the input
+    thread runs input_flush_timer, so that a release still arrives when the
+    mouse stops moving after it.
+*/
+UINT const WM_APP_INPUT = WM_APP;
+UINT_PTR const input_flush_timer = 1;
+input_queue_t<4096> input_queue;
+std::atomic<bool> input_wake_pending;
+uint32_t input_buttons_down;
+uint64_t input_coalesced_reported;
+uint64_t input_dropped_reported;
 
 #define MAX_LOADSTRING 100
 
 // Global Variables:
 HINSTANCE hInst;                                // current instance
+HWND hwnd_main;                                 // the main window
 WCHAR szTitle[MAX_LOADSTRING];                  // The title bar text
 WCHAR szWindowClass[MAX_LOADSTRING];            // the main window class name
 HBRUSH hbrush_background;
@@ -385,8 +179,23 @@ COLORREF color_label_disabled = RGB(192, 192, 192);
 ATOM                MyRegisterClass(HINSTANCE hInstance);
 BOOL                InitInstance(HINSTANCE, int);
 LRESULT CALLBACK    WndProc(HWND, UINT, WPARAM, LPARAM);
+LRESULT CALLBACK    InputWndProc(HWND, UINT, WPARAM, LPARAM);
+DWORD WINAPI        InputThread(LPVOID);
+DWORD WINAPI        RelayoutThread(LPVOID);
 INT_PTR CALLBACK    About(HWND, UINT, WPARAM, LPARAM);
 
+void record_selection(menu_item_t& item, std::chrono::steady_clock::time_point time) {
+    if (item.usage) {
+        auto time_to_select = time - session_start_time;
+        item.usage->record((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(time_to_select).count());
+    }
+    selections_since_relayout += 1;
+    if (selections_since_relayout >= relayout_interval) {
+        selections_since_relayout = 0;
+        SetEvent(relayout_event);
+    }
+}
+
 void SetCursorWindowPos(HWND hwnd, int x, int y) {
     POINT pos;
     pos.x = x;
@@ -422,17 +231,6 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     UNREFERENCED_PARAMETER(hPrevInstance);
     UNREFERENCED_PARAMETER(lpCmdLine);
 
-    RAWINPUTDEVICE rid[1];
-
-    rid[0].usUsagePage = 0x01;
-    rid[0].usUsage = 0x02;
-    rid[0].dwFlags = 0;
-    rid[0].hwndTarget = 0;
-
-    if (RegisterRawInputDevices(rid, sizeof(rid) / sizeof(rid[0]), sizeof(rid[0])) == FALSE) {
-        winapi_failure();
-    }
-
     AllocConsole();
 
     (void)freopen("CON", "w", stdout);
@@ -442,6 +240,9 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     LoadStringW(hInstance, IDC_CONTEXTMENUTEST, szWindowClass, MAX_LOADSTRING);
     MyRegisterClass(hInstance);
 
+    menu_reader = menu_rcu.acquire_reader();
+    menu_rcu.publish(make_default_menu());
+
     hbrush_background = CreateSolidBrush(RGB(255, 255, 255));
     hpen_geometry_passive = CreatePen(PS_SOLID, 0, RGB(128, 128, 128));
     hpen_geometry_active = CreatePen(PS_SOLID, 0, RGB(255, 0, 0));
@@ -482,6 +283,16 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
         return FALSE;
     }
 
+    input_queue.reset();
+    if (!CreateThread(nullptr, 0, InputThread, nullptr, 0, nullptr)) {
+        winapi_failure();
+    }
+    relayout_reader = menu_rcu.acquire_reader();
+    relayout_event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!relayout_event || !CreateThread(nullptr, 0, RelayoutThread, nullptr, 0, nullptr)) {
+        winapi_failure();
+    }
+
     HACCEL hAccelTable = LoadAccelerators(hInstance, MAKEINTRESOURCE(IDC_CONTEXTMENUTEST));
 
     MSG msg;
@@ -544,12 +355,239 @@ BOOL InitInstance(HINSTANCE hInstance, int nCmdShow) {
         return FALSE;
     }
 
+    hwnd_main = hWnd;
     ShowWindow(hWnd, nCmdShow);
     UpdateWindow(hWnd);
 
     return TRUE;
 }
 
+//
+//  FUNCTION: InputThread(LPVOID)
+//
+//  PURPOSE: Receives raw mouse input on a message-only window and queues it for the main window.
+//
+DWORD WINAPI InputThread(LPVOID) {
+    WNDCLASSEXW wcex = {};
+    wcex.cbSize = sizeof(WNDCLASSEX);
+    wcex.lpfnWndProc = InputWndProc;
+    wcex.hInstance = hInst;
+    wcex.lpszClassName = L"ContextMenuTestInput";
+    if (!RegisterClassExW(&wcex)) {
+        winapi_failure();
+    }
+    HWND hwnd = CreateWindowExW(0, wcex.lpszClassName, L"", 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, hInst, nullptr);
+    if (!hwnd) {
+        winapi_failure();
+    }
+
+    RAWINPUTDEVICE rid[1];
+
+    rid[0].usUsagePage = 0x01;
+    rid[0].usUsage = 0x02;
+    rid[0].dwFlags = RIDEV_INPUTSINK;
+    rid[0].hwndTarget = hwnd;
+
+    if (RegisterRawInputDevices(rid, sizeof(rid) / sizeof(rid[0]), sizeof(rid[0])) == FALSE) {
+        winapi_failure();
+    }
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+    MSG msg;
+    while (GetMessage(&msg, nullptr, 0, 0)) {
+        DispatchMessage(&msg);
+    }
+    return 0;
+}
+
+//
+//  FUNCTION: RelayoutThread(LPVOID)
+//
+//  PURPOSE: Moves frequently selected leaves up the menu whenever relayout_event is set.
+//
+DWORD WINAPI RelayoutThread(LPVOID) {
+    for (;;) {
+        if (WaitForSingleObject(relayout_event, INFINITE) != WAIT_OBJECT_0) {
+            winapi_failure();
+        }
+        menu_tree_t* current = menu_rcu.pin(relayout_reader);
+        std::unique_ptr<menu_tree_t> tree = current->clone();
+        if (relayout_step(*tree, relayout_max_moves, relayout_min_count_ratio) != 0) {
+            menu_rcu.publish_if_current(current, std::move(tree));
+        }
+        menu_rcu.unpin(relayout_reader);
+    }
+}
+
+LRESULT CALLBACK InputWndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam) {
+    if (message == WM_INPUT) {
+        input_event_t sample{input_event_kind::delta, 0, input_time_ns(), vec2{0, 0}};
+        RAWINPUT raw;
+        UINT size = sizeof(raw);
+        if (GetRawInputData((HRAWINPUT)lparam, RID_INPUT, &raw, &size, sizeof(RAWINPUTHEADER)) != (UINT)-1
+            && raw.header.dwType == RIM_TYPEMOUSE) {
+            RAWMOUSE const& mouse = raw.data.mouse;
+            sample.foreground = GetForegroundWindow() == hwnd_main;
+            if (sample.foreground && (mouse.usButtonFlags & (RI_MOUSE_LEFT_BUTTON_DOWN | RI_MOUSE_RIGHT_BUTTON_DOWN))) {
+                POINT pos;
+                RECT client_rect;
+                if (GetCursorPos(&pos) && ScreenToClient(hwnd_main, &pos) && GetClientRect(hwnd_main, &client_rect)) {
+                    sample.pointer_x = pos.x;
+                    sample.pointer_y = pos.y;
+                    sample.client_width = client_rect.right - client_rect.left;
+                    sample.client_height = client_rect.bottom - client_rect.top;
+                    sample.in_client = PtInRect(&client_rect, pos) != FALSE;
+                }
+            }
+            if ((mouse.usFlags & MOUSE_MOVE_ABSOLUTE) == 0 && (mouse.lLastX != 0 || mouse.lLastY != 0)) {
+                input_event_t event = sample;
+                event.delta = vec2{(float)mouse.lLastX, (float)mouse.lLastY};
+                input_queue.push(event);
+            }
+            struct button_flag_t {
+                USHORT flag;
+                input_event_kind kind;
+                uint32_t button;
+            };
+            static button_flag_t const button_flags[] = {
+                {RI_MOUSE_LEFT_BUTTON_DOWN, input_event_kind::button_down, input_button_left},
+                {RI_MOUSE_RIGHT_BUTTON_DOWN, input_event_kind::button_down, input_button_right},
+                {RI_MOUSE_LEFT_BUTTON_UP, input_event_kind::button_up, input_button_left},
+                {RI_MOUSE_RIGHT_BUTTON_UP, input_event_kind::button_up, input_button_right},
+            };
+            for (button_flag_t const& button_flag : button_flags) {
+                if (mouse.usButtonFlags & button_flag.flag) {
+                    input_event_t event = sample;
+                    event.kind = button_flag.kind;
+                    event.button = button_flag.button;
+                    input_queue.push(event);
+                }
+            }
+            if (input_queue.pending_count != 0) {
+                SetTimer(hwnd, input_flush_timer, USER_TIMER_MINIMUM, nullptr);
+            }
+            if (!input_wake_pending.exchange(true)) {
+                PostMessageW(hwnd_main, WM_APP_INPUT, 0, 0);
+            }
+        }
+    } else if (message == WM_TIMER && wparam == input_flush_timer) {
+        if (input_queue.flush()) {
+            KillTimer(hwnd, input_flush_timer);
+        }
+        if (!input_wake_pending.exchange(true)) {
+            PostMessageW(hwnd_main, WM_APP_INPUT, 0, 0);
+        }
+        return 0;
+    }
+    return DefWindowProc(hwnd, message, wparam, lparam);
+}
+
+/*
+    Ends the current session without selecting anything and forgets the
+    buttons held down, whose releases would otherwise act on the next one.
+*/
+void cancel_session(HWND hwnd) {
+    input_buttons_down = 0;
+    if (mode != Mode::Disabled) {
+        mode = Mode::Disabled;
+        menu_rcu.unpin(menu_reader);
+        InvalidateRect(hwnd, nullptr, FALSE);
+    }
+}
+
+/*
+    Raw input arrives no matter where the pointer is, so a button press
+    only counts when the main window was in the foreground and the pointer
+    in its client area at the time of the press, as sampled by the input
+    thread, and a release only when its press counted. Deltas only move
+    the selection and warp the pointer back while the window is in the
+    foreground; losing the foreground cancels the session (see WM_ACTIVATE).
+*/
+void handle_input_event(HWND hwnd, input_event_t const& event) {
+    std::chrono::steady_clock::time_point time{std::chrono::nanoseconds(event.time_ns)};
+    uint32_t button_bit = 1u << event.button;
+    if (event.kind == input_event_kind::button_down) {
+        if (!event.foreground || !event.in_client) {
+            return;
+        }
+        input_buttons_down |= button_bit;
+        if (event.button == input_button_left) {
+            if (mode == Mode::Clicked) {
+                mode = Mode::PressedAgain;
+            }
+        } else if (mode == Mode::Clicked) {
+            mode = Mode::PressedAgain;
+        } else {
+            center_point = POINT{event.pointer_x, event.pointer_y};
+            int cx = event.client_width;
+            int cy = event.client_height;
+            if (center_point.x < params.min_window_margin) {
+                center_point.x = params.min_window_margin;
+            } else if (center_point.x > cx - params.min_window_margin) {
+                center_point.x = cx - params.min_window_margin;
+            }
+            if (center_point.y < params.min_window_margin) {
+                center_point.y = params.min_window_margin;
+            } else if (center_point.y > cy - params.min_window_margin) {
+                center_point.y = cy - params.min_window_margin;
+            }
+            menu_state.reset(menu_rcu.pin(menu_reader));
+            session_start_time = time;
+
+            SetCursorWindowPos(hwnd, center_point.x, center_point.y);
+
+            mode = Mode::Pressed;
+
+            InvalidateRect(hwnd, nullptr, FALSE);
+        }
+    } else if (event.kind == input_event_kind::button_up) {
+        if ((input_buttons_down & button_bit) == 0) {
+            return;
+        }
+        input_buttons_down &= ~button_bit;
+        if (event.button == input_button_left) {
+            if (mode == Mode::PressedAgain) {
+                menu_item_t* item_ptr = menu_state.selected_leaf_item();
+                if (item_ptr) {
+                    last_selected_action = item_ptr->opt_action;
+                    if (last_selected_action) {
+                        wprintf(L"%s\n", last_selected_action->name.c_str());
+                        record_selection(*item_ptr, time);
+                    }
+                }
+                mode = Mode::Disabled;
+                menu_rcu.unpin(menu_reader);
+                InvalidateRect(hwnd, nullptr, FALSE);
+            }
+        } else {
+            menu_item_t* item_ptr = menu_state.selected_leaf_item();
+            if (item_ptr) {
+                last_selected_action = item_ptr->opt_action;
+                if (last_selected_action) {
+                    wprintf(L"%s\n", last_selected_action->name.c_str());
+                    record_selection(*item_ptr, time);
+                }
+                mode = Mode::Disabled;
+                menu_rcu.unpin(menu_reader);
+            } else {
+                if (mode == Mode::PressedAgain) {
+                    mode = Mode::Disabled;
+                    menu_rcu.unpin(menu_reader);
+                } else {
+                    mode = Mode::Clicked;
+                }
+            }
+            InvalidateRect(hwnd, nullptr, FALSE);
+        }
+    } else if (mode != Mode::Disabled && event.foreground) {
+        menu_state.apply_delta(vec2{event.delta.x / display_scale, event.delta.y / display_scale});
+
+        SetCursorWindowPos(hwnd, center_point.x, center_point.y);
+
+        InvalidateRect(hwnd, nullptr, FALSE);
+    }
+}
+
 LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam) {
     switch (message) {
     case WM_DESTROY:
@@ -574,10 +612,7 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
         }
         case IDM_CANCEL:
         {
-            if (mode != Mode::Disabled) {
-                mode = Mode::Disabled;
-                InvalidateRect(hwnd, nullptr, FALSE);
-            }
+            cancel_session(hwnd);
         }
         default:
         {
@@ -606,198 +641,55 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
         SelectObject(dc, bm);
         RECT fill_rect{0, 0, cx, cy};
         FillRect(dc, &fill_rect, hbrush_background);
-        auto to_screen = [&](vec2 a, int& ax, int& ay) {
-            ax = center_point.x + (int)(display_scale * a.x);
-            ay = center_point.y + (int)(display_scale * a.y);
-        };
-        auto line = [&](vec2 a, vec2 b) {
-            int ax, ay, bx, by;
-            to_screen(a, ax, ay);
-            to_screen(b, bx, by);
-            MoveToEx(dc, ax, ay, nullptr);
-            LineTo(dc, bx, by);
-        };
-        SetTextAlign(dc, TA_LEFT | TA_TOP);
-        auto text = [&](vec2 base, vec2 delta, std::wstring const& str) {
-            SIZE tsize;
-            GetTextExtentPoint32W(dc, str.data(), (int)str.size(), &tsize);
-            delta.x *= (float)tsize.cx;
-            delta.y *= (float)tsize.cy;
-            vec2 a = base;
-            int ax, ay;
-            to_screen(a, ax, ay);
-            ax += (int)delta.x;
-            ay += (int)delta.y;
-            TextOutW(dc, ax, ay, str.data(), (int)str.size());
-        };
+        paint_commands.resize(0);
         if (mode != Mode::Disabled) {
             SelectObject(dc, hfont_label);
-            if (menu_state.branches.size() == 0) {
-                SelectObject(dc, hpen_geometry_active);
-            } else {
-                SelectObject(dc, hpen_geometry_passive);
-            }
-            for (int i = 0; i < 8; ++i) {
-                vec2 p = params.initial_radius * vec2{1, tan_pi_8};
-                vec2 gpa = rotor(i) % p;
-                vec2 gpb = rotor(i) % ~p;
-                line(gpa, gpb);
-                vec2 t = vec2{params.initial_radius + params.branch_label_height_offset, 0};
-                vec2 gt = rotor(i) % t;
-                COLORREF t_color = color_label_waiting;
-                if (menu_state.branches.size() >= 1) {
-                    if (+menu_state.branches[0].rot == i) {
-                        t_color = color_label_selected;
-                    } else {
-                        t_color = color_label_disabled;
-                    }
-                }
-                if (t_color != color_label_selected) {
-                    SetTextColor(dc, t_color);
-                    text(gt, text_delta_table[i], menu[i].description);
-                }
-            }
-            for (size_t i = 0; i < menu_state.branches.size(); ++i) {
-                menu_state_t::branch_t& branch = menu_state.branches[i];
-                bool is_active = i == menu_state.branches.size() - 1;
-                if (branch.menu_item_ptr->submenu) {
-                    menu_item_t::submenu_t& submenu = *branch.menu_item_ptr->submenu;
-                    /*
-                        px = left_slope * py
-
-                        py = base_width + sector_slope * px
-                        py = base_width / (1 - sector_slope * base_slope)
-
-                        py = - base_width - sector_slope * px
-                        py = - base_width / (1 + sector_slope * base_slope)
-
-
-
-                        px = base_slope * py + trigger
-
-                        py = bot_offset + sector_slope * px
-                        py = (bot_offset + sector_slope * trigger) / (1 - sector_slope * base_slope)
-
-                        py = - top_offset - sector_slope * px
-                        py = - (top_offset + sector_slope * trigger) / (1 + sector_slope * base_slope)
-                    */
-                    vec2 pos = ~branch.rot % (menu_state.global_pos - branch.origin);
-                    float bot_offset = branch.bot_offset;
-                    if (!branch.bot_active) {
-                        float y_distance = bot_offset + params.sector_edge_slope * pos.x - pos.y;
-                        if (y_distance < bot_offset) {
-                            bot_offset += bot_offset - y_distance;
-                        }
-                    }
-                    float top_offset = branch.top_offset;
-                    if (!branch.top_active) {
-                        float y_distance = top_offset + params.sector_edge_slope * pos.x + pos.y;
-                        if (y_distance < top_offset) {
-                            top_offset += top_offset - y_distance;
-                        }
-                    }
-                    float a = bot_offset / (1 - branch.base_slope * params.sector_edge_slope);
-                    float b = -top_offset / (1 + branch.base_slope * params.sector_edge_slope);
-                    vec2 pa = vec2{branch.base_slope * a, a};
-                    vec2 pb = vec2{branch.base_slope * b, b};
-                    vec2 qa = vec2{0, bot_offset} + (10 * params.initial_radius) * vec2 { 1, params.sector_edge_slope };
-                    vec2 qb = vec2{0, -top_offset} + (10 * params.initial_radius) * vec2 { 1, -params.sector_edge_slope };
-                    vec2 gpa = branch.origin + branch.rot % pa;
-                    vec2 gpb = branch.origin + branch.rot % pb;
-                    vec2 gqa = branch.origin + branch.rot % qa;
-                    vec2 gqb = branch.origin + branch.rot % qb;
-                    if (is_active) {
-                        SelectObject(dc, hpen_geometry_active);
-                    }
-                    line(gpa, gpb);
-                    if (is_active && branch.bot_active) {
-                        SelectObject(dc, hpen_geometry_active);
-                    } else {
-                        SelectObject(dc, hpen_geometry_passive);
-                    }
-                    line(gqa, gpa);
-                    if (is_active && branch.top_active) {
-                        SelectObject(dc, hpen_geometry_active);
-                    } else {
-                        SelectObject(dc, hpen_geometry_passive);
-                    }
-                    line(gpb, gqb);
-                    if (is_active && (!branch.top_active || !branch.bot_active)) {
-                        float at = (bot_offset + params.sector_edge_slope * branch.trigger_offset) / (1 - branch.base_slope * params.sector_edge_slope);
-                        float bt = (-top_offset - params.sector_edge_slope * branch.trigger_offset) / (1 + branch.base_slope * params.sector_edge_slope);
-                        vec2 pat = vec2{branch.base_slope * at + branch.trigger_offset, at};
-                        vec2 pbt = vec2{branch.base_slope * bt + branch.trigger_offset, bt};
-                        vec2 gpat = branch.origin + branch.rot % pat;
-                        vec2 gpbt = branch.origin + branch.rot % pbt;
-                        SelectObject(dc, hpen_geometry_active);
-                        line(gpat, gpbt);
-                    }
-                    vec2 tdx = params.branch_label_height_offset * vec2{branch.base_slope, 1};
-                    vec2 tdya = params.branch_label_length_offset * vec2{1, params.sector_edge_slope};
-                    vec2 tdyb = params.branch_label_length_offset * vec2{1, -params.sector_edge_slope};
-                    vec2 ta = pa + tdx + tdya;
-                    vec2 tb = pb - tdx + tdyb;
-                    vec2 gta = branch.origin + branch.rot % ta;
-                    vec2 gtb = branch.origin + branch.rot % tb;
-                    COLORREF color_ta = color_label_disabled;
-                    COLORREF color_tb = color_label_disabled;
-                    if (menu_state.branches.size() > (i + 1)) {
-                        rotor delta_rot = ~menu_state.branches[i].rot + menu_state.branches[i + 1].rot;
-                        if (+delta_rot == 2) {
-                            color_ta = color_label_selected;
-                        } else if (+delta_rot == 6) {
-                            color_tb = color_label_selected;
-                        }
-                    } else {
-                        color_ta = color_label_waiting;
-                        color_tb = color_label_waiting;
-                    }
-                    if (color_ta != color_label_selected) {
-                        vec2 tadelta = text_delta_table[+(menu_state.branches[i].rot + (rotor)1)];
-                        SetTextColor(dc, color_ta);
-                        text(gta, tadelta, submenu.right.description);
-                    }
-                    if (color_tb != color_label_selected) {
-                        vec2 tbdelta = text_delta_table[+(menu_state.branches[i].rot + (rotor)7)];
-                        SetTextColor(dc, color_tb);
-                        text(gtb, tbdelta, submenu.left.description);
-                    }
-                } else {
-                    float a = params.leaf_base_offset / (1 - branch.base_slope * params.sector_edge_slope);
-                    float b = -params.leaf_base_offset / (1 + branch.base_slope * params.sector_edge_slope);
-                    vec2 pa = vec2{branch.base_slope * a, a};
-                    vec2 pb = vec2{branch.base_slope * b, b};
-                    vec2 q = vec2{params.leaf_height, 0};
-                    vec2 gpa = branch.origin + branch.rot % pa;
-                    vec2 gpb = branch.origin + branch.rot % pb;
-                    vec2 gq = branch.origin + branch.rot % q;
-                    SelectObject(dc, hpen_geometry_active);
-                    line(gpa, gpb);
-                    line(gpb, gq);
-                    line(gq, gpa);
-                }
-                vec2 t = vec2{params.branch_label_height_offset, 0};
-                vec2 gt = branch.origin + branch.rot % t;
-                vec2 tdelta = text_delta_table[+menu_state.branches[i].rot];
-                SetTextColor(dc, color_label_selected);
-                text(gt, tdelta, branch.menu_item_ptr->description);
-            }
-            SelectObject(dc, hpen_current);
-            if (menu_state.branches.size() == 0) {
-                line(vec2{0,0}, menu_state.global_pos);
-            } else {
-                line(vec2{0,0}, menu_state.branches[0].origin);
-                for (size_t i = 0; i < menu_state.branches.size() - 1; ++i) {
-                    line(menu_state.branches[i].origin, menu_state.branches[i + 1].origin);
-                }
-                line(menu_state.branches.back().origin, menu_state.global_pos);
-            }
+            SetTextAlign(dc, TA_LEFT | TA_TOP);
+            menu_scene_style_t style{(uintptr_t)hpen_geometry_passive, (uintptr_t)hpen_geometry_active, (uintptr_t)hpen_current,
+                (uintptr_t)color_label_waiting, (uintptr_t)color_label_selected, (uintptr_t)color_label_disabled, (uintptr_t)hfont_label};
+            menu_scene_commands(menu_state, center_point.x, center_point.y, style, [dc](std::wstring const& str) {
+                SIZE tsize;
+                GetTextExtentPoint32W(dc, str.data(), (int)str.size(), &tsize);
+                return vec2{(float)tsize.cx, (float)tsize.cy};
+            }, paint_commands);
         }
         if (last_selected_action) {
+            std::wstring const& str = last_selected_action->name;
+            SIZE tsize;
             SelectObject(dc, hfont_selection);
-            SetTextColor(dc, color_label_disabled);
-            TextOutW(dc, 20, 20, last_selected_action->name.data(), (int)last_selected_action->name.size());
+            GetTextExtentPoint32W(dc, str.data(), (int)str.size(), &tsize);
+            paint_commands.push_back(paint_command_t{paint_kind::label, (uintptr_t)color_label_disabled, vec2{20, 20}, vec2{(float)(20 + tsize.cx), (float)(20 + tsize.cy)}, &str, (uintptr_t)hfont_selection});
         }
+        clip_rect_t clip_rect{-1.0f, -1.0f, (float)(cx + 1), (float)(cy + 1)};
+        clip_stats_t clip_stats{};
+        size_t command_count = clip_paint_commands(clip_rect, paint_commands.data(), paint_commands.size(), clip_stats);
+
+        /*
+            Building with PAINT_STATS defined also translates the commands
+            unbatched, to compare, and reports per frame what clipping and
+            batching saved.
+        */
+#if defined(PAINT_STATS)
+        paint_recorder_t unbatched;
+        paint_batch.translate(paint_commands.data(), command_count);
+        paint_batch.run(unbatched);
+        paint_recorder_t batched;
+        paint_batch.batch(paint_commands.data(), command_count);
+        paint_batch.run(batched);
+#else
+        paint_batch.batch(paint_commands.data(), command_count);
+#endif
+        gdi_paint_backend_t gdi{dc};
+        paint_batch.run(gdi);
+
+#if defined(PAINT_STATS)
+        wchar_t paint_report[256];
+        swprintf(paint_report, 256, L"paint: %u lines (%u clipped, %u culled), %u labels (%u culled), "
+            L"%u state changes and %u draw calls batched into %u and %u\n",
+            clip_stats.lines_submitted, clip_stats.lines_clipped, clip_stats.lines_culled, clip_stats.labels_submitted, clip_stats.labels_culled,
+            unbatched.state_changes, unbatched.draw_calls, batched.state_changes, batched.draw_calls);
+        OutputDebugStringW(paint_report);
+#endif
         BitBlt(window_dc, 0, 0, cx, cy, dc, 0, 0, SRCCOPY);
         if (!DeleteObject(bm)) {
             winapi_failure();
@@ -808,104 +700,29 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
         EndPaint(hwnd, &ps);
         return 0;
     }
-    case WM_RBUTTONDOWN:
+    case WM_ACTIVATE:
     {
-        SetCapture(hwnd);
-        if (mode == Mode::Clicked) {
-            mode = Mode::PressedAgain;
-        } else {
-            center_point.x = GET_X_LPARAM(lparam);
-            center_point.y = GET_Y_LPARAM(lparam);
-            RECT client_rect;
-            if (!GetClientRect(hwnd, &client_rect)) {
-                winapi_failure();
-            }
-            int cx = client_rect.right - client_rect.left;
-            int cy = client_rect.bottom - client_rect.top;
-            if (center_point.x < params.min_window_margin) {
-                center_point.x = params.min_window_margin;
-            } else if (center_point.x > cx - params.min_window_margin) {
-                center_point.x = cx - params.min_window_margin;
-            }
-            if (center_point.y < params.min_window_margin) {
-                center_point.y = params.min_window_margin;
-            } else if (center_point.y > cy - params.min_window_margin) {
-                center_point.y = cy - params.min_window_margin;
-            }
-            menu_state.reset();
-
-            SetCursorWindowPos(hwnd, center_point.x, center_point.y);
-
-            mode = Mode::Pressed;
-
-            InvalidateRect(hwnd, nullptr, FALSE);
+        if (LOWORD(wparam) == WA_INACTIVE) {
+            cancel_session(hwnd);
         }
-        return 0;
-    }
-    case WM_RBUTTONUP:
-    {
-        ReleaseCapture();
-        menu_item_t* item_ptr = menu_state.selected_leaf_item();
-        if (item_ptr) {
-            if (item_ptr->opt_action.has_value()) {
-                last_selected_action = &*item_ptr->opt_action;
-                wprintf(L"%s\n", last_selected_action->name.c_str());
-            } else {
-                last_selected_action = nullptr;
-            }
-            mode = Mode::Disabled;
-        } else {
-            if (mode == Mode::PressedAgain) {
-                mode = Mode::Disabled;
-            } else {
-                mode = Mode::Clicked;
-            }
-        }
-        InvalidateRect(hwnd, nullptr, FALSE);
-        return 0;
-    }
-    case WM_LBUTTONDOWN:
-    {
-        SetCapture(hwnd);
-        if (mode == Mode::Clicked) {
-            mode = Mode::PressedAgain;
-        }
-        return 0;
-    }
-    case WM_LBUTTONUP:
-    {
-        ReleaseCapture();
-        if (mode == Mode::PressedAgain) {
-            menu_item_t* item_ptr = menu_state.selected_leaf_item();
-            if (item_ptr) {
-                if (item_ptr->opt_action.has_value()) {
-                    last_selected_action = &*item_ptr->opt_action;
-                    wprintf(L"%s\n", last_selected_action->name.c_str());
-                } else {
-                    last_selected_action = nullptr;
-                }
-            }
-            mode = Mode::Disabled;
-            InvalidateRect(hwnd, nullptr, FALSE);
-        }
-        return 0;
+        return DefWindowProc(hwnd, message, wparam, lparam);
     }
-    case WM_MOUSEMOVE:
+    case WM_APP_INPUT:
     {
-        if (mode != Mode::Disabled) {
-            int dx = GET_X_LPARAM(lparam) - center_point.x;
-            int dy = GET_Y_LPARAM(lparam) - center_point.y;
-
-            if (dx != 0 || dy != 0) {
-                menu_state.apply_delta(vec2{dx / display_scale, dy / display_scale});
-                // menu_state.apply_delta(vec2{(float)dx, (float)dy});
-
-                SetCursorWindowPos(hwnd, center_point.x, center_point.y);
-
-                InvalidateRect(hwnd, nullptr, FALSE);
-            }
+        input_wake_pending.store(false);
+        input_queue.drain([hwnd](input_event_t const& event) {
+            handle_input_event(hwnd, event);
+        });
+        uint64_t coalesced = input_queue.coalesced.load(std::memory_order_relaxed);
+        uint64_t dropped = input_queue.dropped.load(std::memory_order_relaxed);
+        if (coalesced != input_coalesced_reported || dropped != input_dropped_reported) {
+            input_coalesced_reported = coalesced;
+            input_dropped_reported = dropped;
+            wchar_t input_report[128];
+            swprintf(input_report, 128, L"input queue overflow: %llu events held back, %llu dropped\n",
+                (unsigned long long)coalesced, (unsigned long long)dropped);
+            OutputDebugStringW(input_report);
         }
-
         return 0;
     }
     default:
@@ -0,0 +1,135 @@
+// MenuClip.h : Viewport culling and clipping of paint geometry, independent of the window system.
+//
+
+#pragma once
+
+#include "MenuEngine.h"
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Paint code records its primitives as paint commands in window pixels
+    and hands the whole list to clip_paint_commands before anything is
+    drawn. style and font are opaque here and interpreted by whoever draws
+    the commands (a pen for lines, a text color and a font for labels).
+
+    A line runs from a to b. A label is drawn with its top left corner at a
+    and b is the bottom right corner of its layout box.
+*/
+enum class paint_kind: uint8_t {
+    line,
+    label,
+};
+
+struct paint_command_t {
+    paint_kind kind;
+    uintptr_t style;
+    vec2 a;
+    vec2 b;
+    std::wstring const* text;
+    uintptr_t font;
+};
+
+struct clip_rect_t {
+    float left;
+    float top;
+    float right;
+    float bottom;
+};
+
+struct clip_stats_t {
+    uint32_t lines_submitted;
+    uint32_t lines_clipped;
+    uint32_t lines_culled;
+    uint32_t labels_submitted;
+    uint32_t labels_culled;
+};
+
+uint32_t const clip_left = 1;
+uint32_t const clip_right = 2;
+uint32_t const clip_top = 4;
+uint32_t const clip_bottom = 8;
+
+inline uint32_t clip_outcode(clip_rect_t const& rect, vec2 p) {
+    return (p.x < rect.left ? clip_left : 0)
+        | (p.x > rect.right ? clip_right : 0)
+        | (p.y < rect.top ? clip_top : 0)
+        | (p.y > rect.bottom ? clip_bottom : 0);
+}
+
+/*
+    Liang-Barsky: clips the segment a-b to rect in place, returns false if
+    nothing of it is left.
+*/
+inline bool clip_line(clip_rect_t const& rect, vec2& a, vec2& b) {
+    vec2 d = b - a;
+    float t0 = 0.0f;
+    float t1 = 1.0f;
+    float p[4] = {-d.x, d.x, -d.y, d.y};
+    float q[4] = {a.x - rect.left, rect.right - a.x, a.y - rect.top, rect.bottom - a.y};
+    for (int i = 0; i < 4; ++i) {
+        if (p[i] == 0) {
+            if (q[i] < 0) {
+                return false;
+            }
+            continue;
+        }
+        float t = q[i] / p[i];
+        if (p[i] < 0) {
+            t0 = t > t0 ? t : t0;
+        } else {
+            t1 = t < t1 ? t : t1;
+        }
+        if (t0 > t1) {
+            return false;
+        }
+    }
+    vec2 start = a;
+    if (t1 < 1.0f) {
+        b = start + t1 * d;
+    }
+    if (t0 > 0.0f) {
+        a = start + t0 * d;
+    }
+    return true;
+}
+
+/*
+    Drops the commands that lie entirely outside rect and clips the lines
+    that cross it, keeping the order of the rest. Lines are sorted out by
+    their Cohen-Sutherland outcodes first, so only lines that straddle an
+    edge of the viewport pay for Liang-Barsky. Returns the number of
+    commands left at the front of the array and adds to stats.
+*/
+inline size_t clip_paint_commands(clip_rect_t const& rect, paint_command_t* commands, size_t n, clip_stats_t& stats) {
+    size_t kept = 0;
+    for (size_t i = 0; i < n; ++i) {
+        paint_command_t command = commands[i];
+        uint32_t code_a = clip_outcode(rect, command.a);
+        uint32_t code_b = clip_outcode(rect, command.b);
+        if (command.kind == paint_kind::line) {
+            if ((code_a & code_b) != 0) {
+                stats.lines_culled += 1;
+                continue;
+            }
+            if ((code_a | code_b) != 0) {
+                if (!clip_line(rect, command.a, command.b)) {
+                    stats.lines_culled += 1;
+                    continue;
+                }
+                stats.lines_clipped += 1;
+            }
+            stats.lines_submitted += 1;
+        } else {
+            if ((code_a & code_b) != 0) {
+                stats.labels_culled += 1;
+                continue;
+            }
+            stats.labels_submitted += 1;
+        }
+        commands[kept] = command;
+        kept += 1;
+    }
+    return kept;
+}
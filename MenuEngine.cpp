@@ -0,0 +1,289 @@
+// MenuEngine.cpp : Out-of-line parts of the menu engine.
+//
+
+#include "MenuEngine.h"
+
+params_t params;
+
+menu_item_t menu_item_t::clone() const {
+    menu_item_t item{description, nullptr, opt_action, usage};
+    if (submenu) {
+        std::vector<menu_item_t> children;
+        children.reserve(submenu->children.size());
+        for (menu_item_t const& child : submenu->children) {
+            children.push_back(child.clone());
+        }
+        item.submenu = submenu_t::make(std::move(children));
+    }
+    return item;
+}
+
+menu_item_t menu_item_t::leaf(std::wstring descr) {
+    std::wstring d2 = descr;
+    return menu_item_t{std::move(descr), nullptr, action_t{std::move(d2)}, std::make_shared<leaf_usage_t>()};
+}
+
+uint8_t const nary_offset_table[9][8] = {
+    {},
+    {0},
+    {6, 2},
+    {6, 0, 2},
+    {6, 7, 1, 2},
+    {6, 7, 0, 1, 2},
+    {5, 6, 7, 1, 2, 3},
+    {5, 6, 7, 0, 1, 2, 3},
+    {4, 5, 6, 7, 0, 1, 2, 3},
+};
+
+static std::vector<nary_layout_t> make_nary_layouts() {
+    float const pi = 3.14159265f;
+    std::vector<nary_layout_t> layouts(9);
+    for (int n = 1; n <= 8; ++n) {
+        nary_layout_t& layout = layouts[n];
+        for (int k = 0; k < 8; ++k) {
+            layout.offsets[k] = nary_offset_table[n][k];
+        }
+        for (int bin = 0; bin < sector_bin_count; ++bin) {
+            float p = (bin + 0.5f) / (sector_bin_count / 4);
+            vec2 v;
+            if (p < 1) {
+                v = vec2{1 - p, p};
+            } else if (p < 2) {
+                v = vec2{1 - p, 2 - p};
+            } else if (p < 3) {
+                v = vec2{p - 3, 2 - p};
+            } else {
+                v = vec2{p - 3, p - 4};
+            }
+            float angle = atan2f(v.y, v.x);
+            uint8_t best = no_child;
+            float best_distance = 1.5f * (pi / 4) + 1e-3f;
+            for (int k = 0; k < n; ++k) {
+                float distance = fmodf(fabsf(angle - layout.offsets[k] * (pi / 4)), 2 * pi);
+                distance = fminf(distance, 2 * pi - distance);
+                if (distance < best_distance) {
+                    best = (uint8_t)k;
+                    best_distance = distance;
+                }
+            }
+            layout.sector_table[bin] = best;
+        }
+    }
+    return layouts;
+}
+
+std::vector<nary_layout_t> const nary_layouts = make_nary_layouts();
+
+static void collect_relayout_leaves(menu_item_t& item, int depth, std::vector<relayout_leaf_t>& leaves) {
+    if (item.submenu) {
+        for (menu_item_t& child : item.submenu->children) {
+            collect_relayout_leaves(child, depth + 1, leaves);
+        }
+    } else if (item.usage) {
+        leaves.push_back(relayout_leaf_t{&item, depth, item.usage->selections.load(std::memory_order_relaxed)});
+    }
+}
+
+std::vector<relayout_leaf_t> collect_relayout_leaves(menu_tree_t& tree) {
+    std::vector<relayout_leaf_t> leaves;
+    for (int i = 0; i < 8; ++i) {
+        collect_relayout_leaves(tree.root[i], 1, leaves);
+    }
+    return leaves;
+}
+
+float expected_depth(menu_tree_t& tree) {
+    uint64_t total_selections = 0;
+    uint64_t total_depth = 0;
+    for (relayout_leaf_t const& leaf : collect_relayout_leaves(tree)) {
+        total_selections += leaf.selections;
+        total_depth += leaf.selections * leaf.depth;
+    }
+    if (total_selections == 0) {
+        return 0;
+    }
+    return (float)total_depth / (float)total_selections;
+}
+
+size_t relayout_step(menu_tree_t& tree, size_t max_moves, float min_count_ratio) {
+    std::vector<relayout_leaf_t> leaves = collect_relayout_leaves(tree);
+    std::vector<int> rank_depths;
+    rank_depths.reserve(leaves.size());
+    for (relayout_leaf_t const& leaf : leaves) {
+        rank_depths.push_back(leaf.depth);
+    }
+    std::sort(rank_depths.begin(), rank_depths.end());
+    std::stable_sort(leaves.begin(), leaves.end(), [](relayout_leaf_t const& a, relayout_leaf_t const& b) {
+        return a.selections > b.selections;
+    });
+    std::vector<relayout_leaf_t*> promoted;
+    std::vector<relayout_leaf_t*> demoted;
+    for (size_t r = 0; r < leaves.size(); ++r) {
+        if (leaves[r].depth > rank_depths[r]) {
+            promoted.push_back(&leaves[r]);
+        } else if (leaves[r].depth < rank_depths[r]) {
+            demoted.push_back(&leaves[r]);
+        }
+    }
+    std::reverse(demoted.begin(), demoted.end());
+    size_t moves = 0;
+    for (size_t j = 0; j < promoted.size() && j < demoted.size() && moves < max_moves; ++j) {
+        relayout_leaf_t& hot = *promoted[j];
+        relayout_leaf_t& cold = *demoted[j];
+        if (hot.depth <= cold.depth) {
+            continue;
+        }
+        if ((float)hot.selections <= min_count_ratio * (float)cold.selections) {
+            continue;
+        }
+        std::swap(*hot.menu_item_ptr, *cold.menu_item_ptr);
+        moves += 1;
+    }
+    return moves;
+}
+
+struct menu_line_t {
+    size_t indent;
+    std::wstring_view text;
+    size_t line_number;
+};
+
+static bool parse_menu_items(std::vector<menu_line_t> const& lines, size_t& pos, size_t indent, std::vector<menu_item_t>& items, size_t& error_line) {
+    while (pos < lines.size() && lines[pos].indent == indent) {
+        menu_line_t const& line = lines[pos];
+        pos += 1;
+        if (pos < lines.size() && lines[pos].indent > indent) {
+            std::vector<menu_item_t> children;
+            if (!parse_menu_items(lines, pos, lines[pos].indent, children, error_line)) {
+                return false;
+            }
+            if (children.size() < 2 || children.size() > 8) {
+                error_line = line.line_number;
+                return false;
+            }
+            items.push_back(menu_item_t{std::wstring(line.text) + L"...", menu_item_t::submenu_t::make(std::move(children))});
+        } else if (line.text == L"-") {
+            items.push_back(menu_item_t{});
+        } else {
+            items.push_back(menu_item_t::leaf(std::wstring(line.text)));
+        }
+    }
+    if (pos < lines.size() && lines[pos].indent > indent) {
+        error_line = lines[pos].line_number;
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<menu_tree_t> parse_menu(std::wstring_view text, size_t& error_line) {
+    std::vector<menu_line_t> lines;
+    size_t line_number = 0;
+    while (text.size() != 0) {
+        size_t end = text.find(L'\n');
+        std::wstring_view line = text.substr(0, end);
+        text.remove_prefix(end == std::wstring_view::npos ? text.size() : end + 1);
+        line_number += 1;
+        while (line.size() != 0 && (line.back() == L'\r' || line.back() == L' ' || line.back() == L'\t')) {
+            line.remove_suffix(1);
+        }
+        size_t indent = line.find_first_not_of(L" \t");
+        if (indent == std::wstring_view::npos || line[indent] == L'#') {
+            continue;
+        }
+        lines.push_back(menu_line_t{indent, line.substr(indent), line_number});
+    }
+    std::vector<menu_item_t> items;
+    size_t pos = 0;
+    if (lines.size() == 0) {
+        error_line = 1;
+        return nullptr;
+    }
+    if (!parse_menu_items(lines, pos, lines[0].indent, items, error_line)) {
+        return nullptr;
+    }
+    if (pos < lines.size()) {
+        error_line = lines[pos].line_number;
+        return nullptr;
+    }
+    if (items.size() != 8) {
+        error_line = lines.back().line_number;
+        return nullptr;
+    }
+    auto tree = std::make_unique<menu_tree_t>();
+    for (int i = 0; i < 8; ++i) {
+        tree->root[i] = std::move(items[i]);
+    }
+    return tree;
+}
+
+std::wstring utf8_to_wstring(char const* text, size_t length) {
+    std::wstring result;
+    result.reserve(length);
+    size_t i = 0;
+    while (i < length) {
+        uint8_t c = (uint8_t)text[i];
+        uint32_t cp;
+        size_t extra;
+        if (c < 0x80) {
+            cp = c;
+            extra = 0;
+        } else if ((c & 0xe0) == 0xc0) {
+            cp = c & 0x1f;
+            extra = 1;
+        } else if ((c & 0xf0) == 0xe0) {
+            cp = c & 0x0f;
+            extra = 2;
+        } else if ((c & 0xf8) == 0xf0) {
+            cp = c & 0x07;
+            extra = 3;
+        } else {
+            cp = 0xfffd;
+            extra = 0;
+        }
+        i += 1;
+        for (size_t k = 0; k < extra; ++k) {
+            if (i >= length || ((uint8_t)text[i] & 0xc0) != 0x80) {
+                cp = 0xfffd;
+                break;
+            }
+            cp = (cp << 6) | ((uint8_t)text[i] & 0x3f);
+            i += 1;
+        }
+        if (sizeof(wchar_t) == 2 && cp >= 0x10000) {
+            cp -= 0x10000;
+            result.push_back((wchar_t)(0xd800 + (cp >> 10)));
+            result.push_back((wchar_t)(0xdc00 + (cp & 0x3ff)));
+        } else {
+            result.push_back((wchar_t)cp);
+        }
+    }
+    return result;
+}
+
+std::string wstring_to_utf8(std::wstring const& text) {
+    std::string result;
+    result.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        uint32_t cp = (uint32_t)text[i];
+        if (sizeof(wchar_t) == 2 && cp >= 0xd800 && cp < 0xdc00 && i + 1 < text.size()) {
+            cp = 0x10000 + ((cp - 0xd800) << 10) + ((uint32_t)text[i + 1] - 0xdc00);
+            i += 1;
+        }
+        if (cp < 0x80) {
+            result.push_back((char)cp);
+        } else if (cp < 0x800) {
+            result.push_back((char)(0xc0 | (cp >> 6)));
+            result.push_back((char)(0x80 | (cp & 0x3f)));
+        } else if (cp < 0x10000) {
+            result.push_back((char)(0xe0 | (cp >> 12)));
+            result.push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+            result.push_back((char)(0x80 | (cp & 0x3f)));
+        } else {
+            result.push_back((char)(0xf0 | (cp >> 18)));
+            result.push_back((char)(0x80 | ((cp >> 12) & 0x3f)));
+            result.push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+            result.push_back((char)(0x80 | (cp & 0x3f)));
+        }
+    }
+    return result;
+}
@@ -0,0 +1,1030 @@
+// MenuEngine.h : Menu model and selection state machine, independent of the window system.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <math.h>
+
+struct params_t {
+    float initial_radius = 200.0f;
+    float sector_edge_slope = 0.3f;
+    float branch_near_edge_offset = 100.0f;
+    float branch_far_edge_offset = 100.0f;
+    float branch_far_edge_dead_zone = 150.0f;
+    float branch_label_length_offset = 300.0f;
+    float branch_label_height_offset = 50.0f;
+    float leaf_base_offset = 150.0f;
+    float leaf_height = 400.0f;
+    int min_window_margin = 200;
+};
+extern params_t params;
+
+float const sqrt_1_2 = 0.70710678f;
+float const tan_pi_8 = 0.41421356f;
+
+struct action_t {
+    std::wstring name;
+};
+
+/*
+    Selection statistics of a leaf. Shared between all published versions of
+    the tree, so they follow the leaf when a re-layout moves it.
+*/
+struct leaf_usage_t {
+    std::atomic<uint64_t> selections{0};
+    std::atomic<uint64_t> select_time_us{0};
+
+    void record(uint64_t time_us) {
+        selections.fetch_add(1, std::memory_order_relaxed);
+        select_time_us.fetch_add(time_us, std::memory_order_relaxed);
+    }
+};
+
+struct menu_item_t {
+    struct submenu_t;
+    std::wstring description;
+    std::unique_ptr<submenu_t> submenu = nullptr;
+    std::optional<action_t> opt_action = std::nullopt;
+    std::shared_ptr<leaf_usage_t> usage = nullptr;
+
+    template<typename... items_t>
+    static menu_item_t branch(std::wstring descr, items_t... items);
+    static menu_item_t leaf(std::wstring descr);
+
+    bool is_ring() const;
+    menu_item_t clone() const;
+};
+
+/*
+    A submenu holds 2 to 8 children. Two children form a binary level,
+    selected by crossing the left or the right edge of the branch; 3 to 8
+    form a ring, see nary_layout_t. A single child would be a ring with one
+    spoke, a detour that selects nothing, so neither parse_menu nor branch
+    accepts it.
+*/
+struct menu_item_t::submenu_t {
+    std::vector<menu_item_t> children;
+
+    static std::unique_ptr<submenu_t> make(std::vector<menu_item_t> items) {
+        return std::make_unique<submenu_t>(submenu_t{std::move(items)});
+    }
+
+    bool is_binary() const {
+        return children.size() == 2;
+    }
+};
+
+inline bool menu_item_t::is_ring() const {
+    return submenu && !submenu->is_binary();
+}
+
+template<typename... items_t>
+menu_item_t menu_item_t::branch(std::wstring descr, items_t... items) {
+    static_assert(sizeof...(items) >= 2 && sizeof...(items) <= 8);
+    std::vector<menu_item_t> children;
+    children.reserve(sizeof...(items));
+    (children.push_back(std::move(items)), ...);
+    return menu_item_t{std::move(descr) + L"...", submenu_t::make(std::move(children))};
+}
+
+struct menu_tree_t {
+    menu_item_t root[8];
+
+    std::unique_ptr<menu_tree_t> clone() const {
+        auto tree = std::make_unique<menu_tree_t>();
+        for (int i = 0; i < 8; ++i) {
+            tree->root[i] = root[i].clone();
+        }
+        return tree;
+    }
+};
+
+/*
+    Publishes menu trees to running sessions.
+
+    A session pins the current tree when it starts and keeps using it until
+    it is unpinned, no matter how many trees are published in between.
+    Pinning stamps the reader with the current epoch before loading the tree
+    pointer; publishing swaps the pointer first and advances the epoch after,
+    so a replaced tree can only be held by readers stamped with an epoch not
+    later than the one it was retired at. It is deleted once every reader is
+    either idle or stamped later.
+
+    pin and unpin are wait-free. Writers are serialized among themselves.
+    A writer that derives its tree from the current one publishes it with
+    publish_if_current, so that it never replaces a tree published after
+    the one it started from.
+*/
+struct menu_rcu_t {
+    static uint64_t const idle_epoch = UINT64_MAX;
+
+    struct reader_t {
+        std::atomic<uint64_t> pinned_epoch{idle_epoch};
+        std::atomic<bool> in_use{false};
+        reader_t* next = nullptr;
+    };
+
+    struct retired_t {
+        uint64_t epoch;
+        menu_tree_t* tree;
+    };
+
+    std::atomic<menu_tree_t*> current{nullptr};
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<reader_t*> readers{nullptr};
+    std::mutex writer_mutex;
+    std::vector<retired_t> retired;
+
+    ~menu_rcu_t() {
+        for (retired_t& r : retired) {
+            delete r.tree;
+        }
+        delete current.load();
+        reader_t* reader = readers.load();
+        while (reader) {
+            reader_t* next = reader->next;
+            delete reader;
+            reader = next;
+        }
+    }
+
+    reader_t* acquire_reader() {
+        for (reader_t* reader = readers.load(); reader; reader = reader->next) {
+            bool expected = false;
+            if (reader->in_use.compare_exchange_strong(expected, true)) {
+                return reader;
+            }
+        }
+        reader_t* reader = new reader_t;
+        reader->in_use.store(true);
+        reader_t* head = readers.load();
+        do {
+            reader->next = head;
+        } while (!readers.compare_exchange_weak(head, reader));
+        return reader;
+    }
+
+    void release_reader(reader_t* reader) {
+        reader->pinned_epoch.store(idle_epoch);
+        reader->in_use.store(false);
+    }
+
+    menu_tree_t* pin(reader_t* reader) {
+        reader->pinned_epoch.store(epoch.load());
+        return current.load();
+    }
+
+    void unpin(reader_t* reader) {
+        reader->pinned_epoch.store(idle_epoch);
+    }
+
+    void publish(std::unique_ptr<menu_tree_t> tree) {
+        std::lock_guard<std::mutex> guard(writer_mutex);
+        publish_locked(std::move(tree));
+    }
+
+    /*
+        Publishes tree only if expected is still the current tree and
+        returns false, dropping tree, otherwise. The caller must keep
+        expected pinned until this returns, so that its address cannot have
+        been reused by a newer tree.
+    */
+    bool publish_if_current(menu_tree_t* expected, std::unique_ptr<menu_tree_t> tree) {
+        std::lock_guard<std::mutex> guard(writer_mutex);
+        if (current.load() != expected) {
+            return false;
+        }
+        publish_locked(std::move(tree));
+        return true;
+    }
+
+    void publish_locked(std::unique_ptr<menu_tree_t> tree) {
+        menu_tree_t* old_tree = current.exchange(tree.release());
+        uint64_t old_epoch = epoch.fetch_add(1);
+        if (old_tree) {
+            retired.push_back(retired_t{old_epoch, old_tree});
+        }
+        collect_locked();
+    }
+
+    void collect() {
+        std::lock_guard<std::mutex> guard(writer_mutex);
+        collect_locked();
+    }
+
+    void collect_locked() {
+        if (retired.size() == 0) {
+            return;
+        }
+        uint64_t min_epoch = idle_epoch;
+        for (reader_t* reader = readers.load(); reader; reader = reader->next) {
+            uint64_t reader_epoch = reader->pinned_epoch.load();
+            if (reader_epoch < min_epoch) {
+                min_epoch = reader_epoch;
+            }
+        }
+        size_t kept = 0;
+        for (retired_t& r : retired) {
+            if (r.epoch < min_epoch) {
+                delete r.tree;
+            } else {
+                retired[kept++] = r;
+            }
+        }
+        retired.resize(kept);
+    }
+};
+
+enum class rotor: uint_fast8_t;
+
+inline rotor operator~(rotor a) {
+    return rotor(-(uint_fast8_t)a);
+}
+
+inline rotor operator+(rotor a, rotor b) {
+    return rotor((uint_fast8_t)a + (uint_fast8_t)b);
+}
+
+inline uint_fast8_t operator+(rotor a) {
+    return (uint_fast8_t)a & 7;
+}
+
+/*
+    A direction code packs the path leading to a menu item: bits 0..2 hold
+    the top-level sector, each submenu level then appends the index of the
+    chosen child in just enough bits for the size of that submenu (a single
+    bit for a binary level: 0 for left = rotor(6), 1 for right = rotor(2)),
+    and the highest set bit terminates the sequence. Code 0 means "no item".
+*/
+using direction_code_t = uint64_t;
+int const direction_code_max_length = 63;
+
+inline int direction_code_child_width(size_t child_count) {
+    return (int)std::bit_width(child_count - 1);
+}
+
+inline int direction_code_length(direction_code_t code) {
+    return (int)std::bit_width(code) - 1;
+}
+
+inline direction_code_t direction_code_root(rotor rot) {
+    return (direction_code_t)(+rot) | ((direction_code_t)1 << 3);
+}
+
+inline direction_code_t direction_code_append(direction_code_t code, size_t index, int width) {
+    int length = direction_code_length(code);
+    direction_code_t top = (direction_code_t)1 << length;
+    return (code ^ top) | ((direction_code_t)index << length) | (top << width);
+}
+
+struct vec2 {
+    float x, y;
+
+    vec2 rotp90() const {
+        return vec2{y, -x};
+    }
+
+    vec2 rotm90() const {
+        return vec2{-y, x};
+    }
+
+    vec2& operator+=(vec2 b) {
+        x += b.x;
+        y += b.y;
+        return *this;
+    }
+};
+
+inline vec2 operator-(vec2 a) {
+    return vec2{-a.x, -a.y};
+}
+
+inline vec2 operator~(vec2 a) {
+    return vec2{a.x, -a.y};
+}
+
+inline vec2 operator+(vec2 a, vec2 b) {
+    return vec2{a.x + b.x, a.y + b.y};
+}
+
+inline vec2 operator-(vec2 a, vec2 b) {
+    return vec2{a.x - b.x, a.y - b.y};
+}
+
+inline vec2 operator*(float a, vec2 b) {
+    return vec2{a * b.x, a * b.y};
+}
+
+inline vec2 operator%(rotor a, vec2 b) {
+    uint8_t ai = (uint8_t)a;
+    float rx = b.x;
+    float ry = b.y;
+    if (ai & 4) {
+        rx = -rx;
+        ry = -ry;
+    }
+    if (ai & 2) {
+        float orx = rx;
+        float ory = ry;
+        rx = -ory;
+        ry = orx;
+    }
+    if (ai & 1) {
+        float orx = rx;
+        float ory = ry;
+        rx = sqrt_1_2 * orx - sqrt_1_2 * ory;
+        ry = sqrt_1_2 * orx + sqrt_1_2 * ory;
+    }
+    return vec2{rx, ry};
+}
+
+/*
+    Layout of a ring submenu with the given number of children.
+
+    The ring has the same size as the top-level one and is entered through
+    its rim: its center lies initial_radius ahead of the branch origin. Once
+    the pointer has passed the center, the direction from the center selects
+    a child through sector_table, indexed by the pseudo-angle bin of that
+    direction, and the child's branch opens when the pointer leaves the ring
+    in that direction, exactly like a top-level sector.
+
+    offsets are the child rotors relative to the branch rotor, listed from
+    left to right. Directions farther than one and a half sectors from every
+    child map to no_child.
+*/
+int const sector_bin_count = 256;
+uint8_t const no_child = 0xff;
+
+struct nary_layout_t {
+    uint8_t offsets[8];
+    uint8_t sector_table[sector_bin_count];
+};
+
+inline int sector_bin(vec2 v) {
+    float ax = fabsf(v.x);
+    float ay = fabsf(v.y);
+    float d = ax + ay;
+    if (d == 0) {
+        return 0;
+    }
+    float t = ay / d;
+    float p;
+    if (v.x >= 0) {
+        p = v.y >= 0 ? t : 4 - t;
+    } else {
+        p = v.y >= 0 ? 2 - t : 2 + t;
+    }
+    return (int)(p * (sector_bin_count / 4)) & (sector_bin_count - 1);
+}
+
+extern std::vector<nary_layout_t> const nary_layouts;
+
+/*
+    Changes made by one apply_delta call, reported in the order they happen
+    so that renderers, recorders and analytics can follow the state without
+    diffing branches after every delta. depth is the index of the branch
+    concerned in branches and rot its rotor. parse_menu puts no limit on
+    nesting, so depth is 32 bits wide.
+
+    sector_entered and branch_pushed open branch depth; index is the chosen
+    child of the parent (0 for sector_entered, where rot is the sector).
+    branch_popped closes branch depth. edge_activated reports that the top
+    (index transition_top_edge) or bottom edge of a binary submenu branch
+    became crossable, leaf_armed that a leaf branch passed its trigger and
+    ring_armed that the pointer passed the center of a ring. Activations a
+    branch starts out with are reported right after its push.
+*/
+enum class transition_kind: uint8_t {
+    sector_entered,
+    branch_pushed,
+    branch_popped,
+    edge_activated,
+    leaf_armed,
+    ring_armed,
+};
+
+uint8_t const transition_top_edge = 0;
+uint8_t const transition_bottom_edge = 1;
+
+struct transition_t {
+    transition_kind kind;
+    rotor rot;
+    uint8_t index;
+    uint32_t depth;
+};
+
+/*
+    Where the state machine reads its parameters from. runtime_params_t
+    reads the global params, which can be tuned while the program runs.
+    fixed_params_t bakes a configuration in at compile time, so that every
+    offset and slope in apply_delta folds into a constant; both produce the
+    same states for the same values.
+*/
+struct runtime_params_t {
+    static params_t const& get() {
+        return params;
+    }
+};
+
+template<params_t value>
+struct fixed_params_t {
+    static constexpr params_t const& get() {
+        return value;
+    }
+};
+
+template<typename params_source_t>
+struct basic_menu_state_t {
+    struct branch_t {
+        menu_item_t* menu_item_ptr;
+        vec2 origin;
+        rotor rot;
+        float base_slope;
+        float top_offset;
+        float bot_offset;
+        float trigger_offset;
+        bool top_active;
+        bool bot_active;
+    };
+
+    menu_tree_t* tree;
+    vec2 global_pos;
+    std::vector<branch_t> branches;
+
+    void reset(menu_tree_t* new_tree) {
+        tree = new_tree;
+        global_pos = vec2{0, 0};
+        branches.resize(0);
+    }
+
+    void find_sector(rotor& out_rot, vec2& out_pos) {
+        int side = 0;
+        float x = global_pos.x;
+        float y = global_pos.y;
+        float a = sqrt_1_2 * (x + y);
+        float b = sqrt_1_2 * (- x + y);
+        if (x < -b) {
+            side = 4;
+            x = -x;
+            y = -y;
+            a = -a;
+            b = -b;
+        }
+        if (x < b) {
+            side += 2;
+            float ox = x;
+            float oy = y;
+            float oa = a;
+            float ob = b;
+            x = oy;
+            y = -ox;
+            a = ob;
+            b = -oa;
+        }
+        if (x < a) {
+            out_rot = rotor(side + 1);
+            out_pos = vec2{a, b};
+        } else {
+            out_rot = rotor(side);
+            out_pos = vec2{x, y};
+        }
+    }
+
+    /*
+        Pushes a branch and reports it, followed by the activations it
+        starts out with, so that a consumer sees every activation exactly
+        once whether it happens on entry or later.
+    */
+    template<typename emit_t>
+    void push_branch(branch_t const& branch, uint8_t index, emit_t& emit) {
+        branches.push_back(branch);
+        uint32_t depth = (uint32_t)(branches.size() - 1);
+        emit(transition_t{depth == 0 ? transition_kind::sector_entered : transition_kind::branch_pushed, branch.rot, index, depth});
+        if (branch.top_active) {
+            if (branch.menu_item_ptr->submenu) {
+                emit(transition_t{transition_kind::edge_activated, branch.rot, transition_top_edge, depth});
+                emit(transition_t{transition_kind::edge_activated, branch.rot, transition_bottom_edge, depth});
+            } else {
+                emit(transition_t{transition_kind::leaf_armed, branch.rot, 0, depth});
+            }
+        }
+    }
+
+    template<typename emit_t>
+    void pop_branch(emit_t& emit) {
+        uint32_t depth = (uint32_t)(branches.size() - 1);
+        emit(transition_t{transition_kind::branch_popped, branches.back().rot, 0, depth});
+        branches.pop_back();
+    }
+
+    void apply_delta(vec2 delta) {
+        apply_delta(delta, [](transition_t) {});
+    }
+
+    template<typename emit_t>
+    void apply_delta(vec2 delta, emit_t&& emit) {
+        params_t const& params = params_source_t::get();
+        global_pos += delta;
+    update:
+        if (branches.size() == 0) {
+            rotor rot;
+            vec2 relpos;
+            find_sector(rot, relpos);
+            if (relpos.x > params.initial_radius) {
+                vec2 origin = rot % vec2{params.initial_radius, 0};
+                bool is_active = !tree->root[+rot].is_ring();
+                push_branch(branch_t{
+                    &tree->root[+rot],
+                    origin,
+                    rot,
+                    0,
+                    params.initial_radius * tan_pi_8,
+                    params.initial_radius * tan_pi_8,
+                    0,
+                    is_active,
+                    is_active}, 0, emit);
+                goto update;
+            }
+        } else {
+            branch_t& branch = branches.back();
+            uint32_t depth = (uint32_t)(branches.size() - 1);
+            vec2 pos = ~branch.rot % (global_pos - branch.origin);
+            menu_item_t::submenu_t* submenu = branch.menu_item_ptr->submenu.get();
+            if (submenu && !submenu->is_binary()) {
+                vec2 cpos = pos - vec2{params.initial_radius, 0};
+                if (!branch.top_active && cpos.x > 0) {
+                    branch.top_active = true;
+                    branch.bot_active = true;
+                    emit(transition_t{transition_kind::ring_armed, branch.rot, 0, depth});
+                }
+                if (branch.top_active) {
+                    nary_layout_t const& layout = nary_layouts[submenu->children.size()];
+                    uint8_t k = layout.sector_table[sector_bin(cpos)];
+                    if (k != no_child) {
+                        rotor child_delta_rot = rotor(layout.offsets[k]);
+                        vec2 relpos = ~child_delta_rot % cpos;
+                        if (relpos.x > params.initial_radius) {
+                            menu_item_t& child = submenu->children[k];
+                            bool is_active = !child.is_ring();
+                            push_branch(branch_t{
+                                &child,
+                                branch.origin + branch.rot % (vec2{params.initial_radius, 0} + child_delta_rot % vec2{params.initial_radius, 0}),
+                                branch.rot + child_delta_rot,
+                                0,
+                                params.initial_radius * tan_pi_8,
+                                params.initial_radius * tan_pi_8,
+                                0,
+                                is_active,
+                                is_active}, k, emit);
+                            goto update;
+                        }
+                    }
+                }
+                if (pos.x < pos.y * branch.base_slope) {
+                    pop_branch(emit);
+                    goto update;
+                }
+                return;
+            }
+            if (pos.x < pos.y * branch.base_slope) {
+                pop_branch(emit);
+                goto update;
+            }
+            bool was_armed = branch.top_active && branch.bot_active;
+            float trigger_distance = pos.x - pos.y * branch.base_slope;
+            if (!branch.top_active) {
+                if (trigger_distance > branch.trigger_offset) {
+                    branch.top_active = true;
+                    float y_distance = branch.top_offset + params.sector_edge_slope * pos.x + pos.y;
+                    if (y_distance < branch.top_offset) {
+                        branch.top_offset += branch.top_offset - y_distance;
+                    }
+                    if (submenu) {
+                        emit(transition_t{transition_kind::edge_activated, branch.rot, transition_top_edge, depth});
+                    }
+                }
+            }
+            if (!branch.bot_active) {
+                if (trigger_distance > branch.trigger_offset) {
+                    branch.bot_active = true;
+                    float y_distance = branch.bot_offset + params.sector_edge_slope * pos.x - pos.y;
+                    if (y_distance < branch.bot_offset) {
+                        branch.bot_offset += branch.bot_offset - y_distance;
+                    }
+                    if (submenu) {
+                        emit(transition_t{transition_kind::edge_activated, branch.rot, transition_bottom_edge, depth});
+                    }
+                }
+            }
+            if (!submenu && !was_armed && branch.top_active && branch.bot_active) {
+                emit(transition_t{transition_kind::leaf_armed, branch.rot, 0, depth});
+            }
+            if (submenu) {
+                if (branch.top_active) {
+                    float ylim = branch.top_offset + params.sector_edge_slope * pos.x;
+                    if (pos.y < -ylim) {
+                        if (!branch.bot_active) {
+                            branch.bot_active = true;
+                            emit(transition_t{transition_kind::edge_activated, branch.rot, transition_bottom_edge, depth});
+                        }
+                        push_branch(branch_t{
+                            &submenu->children[0],
+                            branch.origin + branch.rot % vec2{pos.x, -ylim},
+                            branch.rot + rotor(6),
+                            params.sector_edge_slope,
+                            params.branch_near_edge_offset,
+                            params.branch_far_edge_offset,
+                            params.branch_far_edge_dead_zone,
+                            false,
+                            false}, 0, emit);
+                        goto update;
+                    }
+                }
+                if (branch.bot_active) {
+                    float ylim = branch.bot_offset + params.sector_edge_slope * pos.x;
+                    if (pos.y > ylim) {
+                        if (!branch.top_active) {
+                            branch.top_active = true;
+                            emit(transition_t{transition_kind::edge_activated, branch.rot, transition_top_edge, depth});
+                        }
+                        push_branch(branch_t{
+                            &submenu->children[1],
+                            branch.origin + branch.rot % vec2{pos.x, ylim},
+                            branch.rot + rotor(2),
+                            -params.sector_edge_slope,
+                            params.branch_far_edge_offset,
+                            params.branch_near_edge_offset,
+                            params.branch_far_edge_dead_zone,
+                            false,
+                            false}, 1, emit);
+                        goto update;
+                    }
+                }
+            }
+        }
+    }
+
+    menu_item_t* selected_leaf_item() {
+        if (branches.size() == 0) {
+            return nullptr;
+        } else {
+            return branches.back().menu_item_ptr;
+        }
+    }
+
+    direction_code_t direction_code() const {
+        if (branches.size() == 0) {
+            return 0;
+        }
+        direction_code_t code = direction_code_root(branches[0].rot);
+        for (size_t i = 1; i < branches.size(); ++i) {
+            std::vector<menu_item_t>& children = branches[i - 1].menu_item_ptr->submenu->children;
+            size_t index = branches[i].menu_item_ptr - children.data();
+            code = direction_code_append(code, index, direction_code_child_width(children.size()));
+        }
+        return code;
+    }
+};
+
+using menu_state_t = basic_menu_state_t<runtime_params_t>;
+
+/*
+    The state machine specialized for the default configuration, for
+    programs that do not tune params.
+*/
+using fixed_menu_state_t = basic_menu_state_t<fixed_params_t<params_t{}>>;
+
+/*
+    Whether two states, possibly of different configurations, have the same
+    pointer position and branch stack, down to every field of every branch.
+*/
+template<typename a_t, typename b_t>
+bool same_menu_state(a_t const& a, b_t const& b) {
+    if (a.tree != b.tree || a.global_pos.x != b.global_pos.x || a.global_pos.y != b.global_pos.y || a.branches.size() != b.branches.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.branches.size(); ++i) {
+        auto const& p = a.branches[i];
+        auto const& q = b.branches[i];
+        if (p.menu_item_ptr != q.menu_item_ptr || p.origin.x != q.origin.x || p.origin.y != q.origin.y || p.rot != q.rot
+            || p.base_slope != q.base_slope || p.top_offset != q.top_offset || p.bot_offset != q.bot_offset
+            || p.trigger_offset != q.trigger_offset || p.top_active != q.top_active || p.bot_active != q.bot_active) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    Every state a menu_state_t goes through, for stepping back and forth
+    through a recorded trace without replaying it from the start.
+
+    The branch stack is stored as a persistent linked stack in nodes, each
+    node pointing at the branch below it. A snapshot is the pointer position
+    plus the index of its top node, so branches that did not change are
+    shared with earlier snapshots. apply_delta finds the lowest branch that
+    changed from the transition stream and only adds nodes from there up,
+    which costs O(1) time and memory per transition plus one snapshot per
+    delta. restore rebuilds any snapshot in O(depth).
+
+    The tree must outlive the history, and the state must only be changed
+    through apply_delta between reset calls.
+*/
+struct session_history_t {
+    static uint32_t const no_node = UINT32_MAX;
+
+    struct node_t {
+        menu_state_t::branch_t branch;
+        uint32_t parent;
+        uint32_t depth;
+    };
+
+    struct snapshot_t {
+        vec2 global_pos;
+        uint32_t top;
+    };
+
+    menu_tree_t* tree = nullptr;
+    std::vector<node_t> nodes;
+    std::vector<snapshot_t> snapshots;
+
+    void reset(menu_state_t const& state) {
+        tree = state.tree;
+        nodes.resize(0);
+        snapshots.resize(0);
+        uint32_t top = no_node;
+        for (menu_state_t::branch_t const& branch : state.branches) {
+            top = push_node(branch, top);
+        }
+        snapshots.push_back(snapshot_t{state.global_pos, top});
+    }
+
+    uint32_t push_node(menu_state_t::branch_t const& branch, uint32_t parent) {
+        uint32_t depth = parent == no_node ? 1 : nodes[parent].depth + 1;
+        nodes.push_back(node_t{branch, parent, depth});
+        return (uint32_t)(nodes.size() - 1);
+    }
+
+    void apply_delta(menu_state_t& state, vec2 delta) {
+        size_t old_size = state.branches.size();
+        size_t unchanged = old_size;
+        state.apply_delta(delta, [&unchanged](transition_t t) {
+            unchanged = std::min(unchanged, (size_t)t.depth);
+        });
+        uint32_t top = snapshots.back().top;
+        for (size_t i = unchanged; i < old_size; ++i) {
+            top = nodes[top].parent;
+        }
+        for (size_t i = unchanged; i < state.branches.size(); ++i) {
+            top = push_node(state.branches[i], top);
+        }
+        snapshots.push_back(snapshot_t{state.global_pos, top});
+    }
+
+    size_t size() const {
+        return snapshots.size();
+    }
+
+    size_t depth(size_t index) const {
+        uint32_t top = snapshots[index].top;
+        return top == no_node ? 0 : nodes[top].depth;
+    }
+
+    menu_state_t::branch_t const* top_branch(size_t index) const {
+        uint32_t top = snapshots[index].top;
+        return top == no_node ? nullptr : &nodes[top].branch;
+    }
+
+    void restore(size_t index, menu_state_t& state) const {
+        snapshot_t const& snapshot = snapshots[index];
+        state.tree = tree;
+        state.global_pos = snapshot.global_pos;
+        state.branches.resize(depth(index));
+        for (uint32_t node = snapshot.top; node != no_node; node = nodes[node].parent) {
+            state.branches[nodes[node].depth - 1] = nodes[node].branch;
+        }
+    }
+};
+
+/*
+    Precomputed mapping between leaves and their direction codes.
+
+    Waypoints describe the simplest stroke that selects a leaf. Within each
+    branch the stroke follows the axis up to the trigger line at (trigger, 0),
+    where both edges become active without being pushed away, and then turns
+    straight into the chosen edge:
+
+        left:   (trigger, - top_offset - sector_slope * trigger)
+        right:  (trigger, bot_offset + sector_slope * trigger)
+
+    which becomes the origin of the next branch. Top-level branches have no
+    dead zone, and turning right at the origin would run along the sector
+    boundary, so their turns cut diagonally from the origin to the edge point
+    at x = initial_radius * tan_pi_8 instead. Ring levels are crossed through
+    their center straight to the origin of the chosen child.
+
+    These points lie exactly on the lines apply_delta tests with strict
+    inequalities, so the stored waypoints are each moved margin further
+    along the segment that leads to them. Replaying the stored waypoints
+    alone, as one delta per segment or in smaller steps, selects the leaf.
+
+    build returns false if some leaf needs a direction code longer than
+    direction_code_max_length. Such leaves are left out of the index; all
+    other leaves are still indexed.
+*/
+float const leaf_waypoint_margin = 10.0f;
+
+struct leaf_index_t {
+    struct leaf_t {
+        menu_item_t* menu_item_ptr;
+        direction_code_t code;
+        size_t waypoint_begin;
+        size_t waypoint_end;
+    };
+
+    std::vector<leaf_t> leaves;
+    std::vector<vec2> waypoints;
+    std::unordered_map<direction_code_t, size_t> code_map;
+    std::unordered_map<menu_item_t const*, size_t> item_map;
+
+    bool build(menu_tree_t& tree, float margin = leaf_waypoint_margin) {
+        struct frame_t {
+            menu_item_t* menu_item_ptr;
+            direction_code_t code;
+            vec2 origin;
+            rotor rot;
+            float top_offset;
+            float bot_offset;
+            float trigger_offset;
+            float turn_offset;
+            size_t path_size;
+        };
+        leaves.clear();
+        waypoints.clear();
+        code_map.clear();
+        item_map.clear();
+        bool complete = true;
+        std::vector<vec2> path;
+        std::vector<frame_t> stack;
+        for (int i = 7; i >= 0; --i) {
+            rotor rot = rotor(i);
+            stack.push_back(frame_t{
+                &tree.root[i],
+                direction_code_root(rot),
+                rot % vec2{params.initial_radius, 0},
+                rot,
+                params.initial_radius * tan_pi_8,
+                params.initial_radius * tan_pi_8,
+                0,
+                params.initial_radius * tan_pi_8,
+                0});
+        }
+        while (stack.size() != 0) {
+            frame_t frame = stack.back();
+            stack.pop_back();
+            path.resize(frame.path_size);
+            path.push_back(frame.origin);
+            if (!frame.menu_item_ptr->submenu) {
+                size_t index = leaves.size();
+                leaves.push_back(leaf_t{frame.menu_item_ptr, frame.code, waypoints.size(), waypoints.size() + path.size()});
+                vec2 from = vec2{0, 0};
+                for (vec2 to : path) {
+                    vec2 d = to - from;
+                    float length = sqrtf(d.x * d.x + d.y * d.y);
+                    waypoints.push_back(length > 0 ? to + (margin / length) * d : to);
+                    from = to;
+                }
+                code_map.emplace(frame.code, index);
+                item_map.emplace(frame.menu_item_ptr, index);
+                continue;
+            }
+            menu_item_t::submenu_t& submenu = *frame.menu_item_ptr->submenu;
+            int child_width = direction_code_child_width(submenu.children.size());
+            if (direction_code_length(frame.code) + child_width > direction_code_max_length) {
+                complete = false;
+                continue;
+            }
+            if (!submenu.is_binary()) {
+                nary_layout_t const& layout = nary_layouts[submenu.children.size()];
+                vec2 center = frame.origin + frame.rot % vec2{params.initial_radius, 0};
+                path.push_back(center);
+                for (size_t k = submenu.children.size(); k-- > 0;) {
+                    rotor child_rot = frame.rot + rotor(layout.offsets[k]);
+                    stack.push_back(frame_t{
+                        &submenu.children[k],
+                        direction_code_append(frame.code, k, child_width),
+                        center + child_rot % vec2{params.initial_radius, 0},
+                        child_rot,
+                        params.initial_radius * tan_pi_8,
+                        params.initial_radius * tan_pi_8,
+                        0,
+                        params.initial_radius * tan_pi_8,
+                        path.size()});
+                }
+                continue;
+            }
+            if (frame.trigger_offset > 0) {
+                path.push_back(frame.origin + frame.rot % vec2{frame.trigger_offset, 0});
+            }
+            float ylim_right = frame.bot_offset + params.sector_edge_slope * frame.turn_offset;
+            stack.push_back(frame_t{
+                &submenu.children[1],
+                direction_code_append(frame.code, 1, child_width),
+                frame.origin + frame.rot % vec2{frame.turn_offset, ylim_right},
+                frame.rot + rotor(2),
+                params.branch_far_edge_offset,
+                params.branch_near_edge_offset,
+                params.branch_far_edge_dead_zone,
+                params.branch_far_edge_dead_zone,
+                path.size()});
+            float ylim_left = frame.top_offset + params.sector_edge_slope * frame.turn_offset;
+            stack.push_back(frame_t{
+                &submenu.children[0],
+                direction_code_append(frame.code, 0, child_width),
+                frame.origin + frame.rot % vec2{frame.turn_offset, -ylim_left},
+                frame.rot + rotor(6),
+                params.branch_near_edge_offset,
+                params.branch_far_edge_offset,
+                params.branch_far_edge_dead_zone,
+                params.branch_far_edge_dead_zone,
+                path.size()});
+        }
+        return complete;
+    }
+
+    leaf_t const* find(direction_code_t code) const {
+        auto it = code_map.find(code);
+        if (it == code_map.end()) {
+            return nullptr;
+        }
+        return &leaves[it->second];
+    }
+
+    leaf_t const* find(menu_item_t const* menu_item_ptr) const {
+        auto it = item_map.find(menu_item_ptr);
+        if (it == item_map.end()) {
+            return nullptr;
+        }
+        return &leaves[it->second];
+    }
+};
+
+/*
+    Usage-driven re-layout.
+
+    The depth of a leaf is the number of branches open when it is selected.
+    A re-layout step ranks the leaves by selection count, pairs the hottest
+    leaves that sit deeper than their rank deserves with the coldest ones
+    that sit shallower, and swaps the leaves of each pair. The shape of the
+    tree never changes, and every swap lowers the expected depth. A step
+    makes at most max_moves swaps, and only swaps a pair when the hot leaf
+    has been selected more than min_count_ratio times as often as the cold
+    one, so that the layout stays stable once usage settles.
+*/
+struct relayout_leaf_t {
+    menu_item_t* menu_item_ptr;
+    int depth;
+    uint64_t selections;
+};
+
+/*
+    Text form of a menu tree, one item per line:
+
+        # comment
+        6
+          6U
+            6UL
+            6UR
+          6D
+            6DR
+            6DL
+        -
+
+    An item followed by more deeply indented lines is a branch holding those
+    lines as its children, any other item is a leaf. Siblings share the same
+    indentation, a branch holds 2 to 8 children, and the top level holds
+    exactly 8 items in rotor order. A lone "-" stands for an item without an
+    action. Blank lines and lines starting with '#' are ignored.
+
+    Returns nullptr and sets error_line (1-based) if the text is malformed.
+*/
+std::unique_ptr<menu_tree_t> parse_menu(std::wstring_view text, size_t& error_line);
+
+std::wstring utf8_to_wstring(char const* text, size_t length);
+std::string wstring_to_utf8(std::wstring const& text);
+
+std::vector<relayout_leaf_t> collect_relayout_leaves(menu_tree_t& tree);
+float expected_depth(menu_tree_t& tree);
+size_t relayout_step(menu_tree_t& tree, size_t max_moves, float min_count_ratio);
@@ -0,0 +1,138 @@
+// MenuEngineApi.cpp : C interface of the menu engine shared library.
+//
+
+#include "MenuEngineApi.h"
+#include "MenuEngine.h"
+#include <string.h>
+
+struct menu_engine_menu {
+    menu_rcu_t rcu;
+};
+
+struct menu_engine_session {
+    menu_engine_menu* menu;
+    menu_rcu_t::reader_t* reader;
+    menu_state_t state;
+    bool is_active;
+};
+
+static std::unique_ptr<menu_tree_t> parse_menu_utf8(char const* text, size_t length, size_t* error_line) {
+    size_t line = 0;
+    std::unique_ptr<menu_tree_t> tree = parse_menu(utf8_to_wstring(text, length), line);
+    if (!tree && error_line) {
+        *error_line = line;
+    }
+    return tree;
+}
+
+menu_engine_status menu_engine_menu_create(char const* text, size_t length, size_t* error_line, menu_engine_menu** out_menu) {
+    if (!text || !out_menu) {
+        return MENU_ENGINE_INVALID_ARGUMENT;
+    }
+    std::unique_ptr<menu_tree_t> tree = parse_menu_utf8(text, length, error_line);
+    if (!tree) {
+        return MENU_ENGINE_PARSE_ERROR;
+    }
+    menu_engine_menu* menu = new menu_engine_menu;
+    menu->rcu.publish(std::move(tree));
+    *out_menu = menu;
+    return MENU_ENGINE_OK;
+}
+
+menu_engine_status menu_engine_menu_publish(menu_engine_menu* menu, char const* text, size_t length, size_t* error_line) {
+    if (!menu || !text) {
+        return MENU_ENGINE_INVALID_ARGUMENT;
+    }
+    std::unique_ptr<menu_tree_t> tree = parse_menu_utf8(text, length, error_line);
+    if (!tree) {
+        return MENU_ENGINE_PARSE_ERROR;
+    }
+    menu->rcu.publish(std::move(tree));
+    return MENU_ENGINE_OK;
+}
+
+void menu_engine_menu_destroy(menu_engine_menu* menu) {
+    delete menu;
+}
+
+menu_engine_session* menu_engine_session_create(menu_engine_menu* menu) {
+    if (!menu) {
+        return nullptr;
+    }
+    menu_engine_session* session = new menu_engine_session;
+    session->menu = menu;
+    session->reader = menu->rcu.acquire_reader();
+    session->state.reset(nullptr);
+    session->is_active = false;
+    return session;
+}
+
+void menu_engine_session_destroy(menu_engine_session* session) {
+    if (!session) {
+        return;
+    }
+    session->menu->rcu.release_reader(session->reader);
+    delete session;
+}
+
+menu_engine_status menu_engine_session_begin(menu_engine_session* session) {
+    if (!session) {
+        return MENU_ENGINE_INVALID_ARGUMENT;
+    }
+    session->state.reset(session->menu->rcu.pin(session->reader));
+    session->is_active = true;
+    return MENU_ENGINE_OK;
+}
+
+menu_engine_status menu_engine_session_end(menu_engine_session* session) {
+    if (!session) {
+        return MENU_ENGINE_INVALID_ARGUMENT;
+    }
+    session->menu->rcu.unpin(session->reader);
+    session->state.reset(nullptr);
+    session->is_active = false;
+    return MENU_ENGINE_OK;
+}
+
+size_t menu_engine_apply_deltas(menu_engine_session* session, float const* xy, size_t n, menu_engine_event* events_out) {
+    if (!session || (n != 0 && (!xy || !events_out)) || !session->is_active) {
+        return 0;
+    }
+    menu_state_t& state = session->state;
+    menu_item_t* last_item = state.selected_leaf_item();
+    size_t event_count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        state.apply_delta(vec2{xy[2 * i], xy[2 * i + 1]});
+        menu_item_t* item = state.selected_leaf_item();
+        if (item != last_item) {
+            last_item = item;
+            events_out[event_count] = menu_engine_event{(uint32_t)i, (uint32_t)state.branches.size(), state.direction_code()};
+            event_count += 1;
+        }
+    }
+    return event_count;
+}
+
+uint64_t menu_engine_session_selected(menu_engine_session const* session) {
+    if (!session) {
+        return 0;
+    }
+    return session->state.direction_code();
+}
+
+menu_engine_status menu_engine_session_selected_name(menu_engine_session const* session, char* buffer, size_t size, size_t* out_length) {
+    if (!session) {
+        return MENU_ENGINE_INVALID_ARGUMENT;
+    }
+    menu_item_t const* item = session->state.branches.size() != 0 ? session->state.branches.back().menu_item_ptr : nullptr;
+    std::string name = item ? wstring_to_utf8(item->description) : std::string();
+    if (out_length) {
+        *out_length = name.size();
+    }
+    if (!buffer || size < name.size() + 1) {
+        return MENU_ENGINE_BUFFER_TOO_SMALL;
+    }
+    memcpy(buffer, name.data(), name.size());
+    buffer[name.size()] = 0;
+    return MENU_ENGINE_OK;
+}
@@ -0,0 +1,92 @@
+/* MenuEngineApi.h : C interface of the menu engine shared library. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(MENUENGINE_EXPORTS)
+#define MENU_ENGINE_API __declspec(dllexport)
+#else
+#define MENU_ENGINE_API __declspec(dllimport)
+#endif
+#else
+#define MENU_ENGINE_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct menu_engine_menu menu_engine_menu;
+typedef struct menu_engine_session menu_engine_session;
+
+typedef enum menu_engine_status {
+    MENU_ENGINE_OK = 0,
+    MENU_ENGINE_INVALID_ARGUMENT = 1,
+    MENU_ENGINE_PARSE_ERROR = 2,
+    MENU_ENGINE_BUFFER_TOO_SMALL = 3,
+} menu_engine_status;
+
+/*
+    Emitted by menu_engine_apply_deltas for every delta after which a
+    different item is selected. depth is the number of open branches and
+    direction_code identifies the selected item, both are 0 when the pointer
+    is back inside the initial circle.
+*/
+typedef struct menu_engine_event {
+    uint32_t delta_index;
+    uint32_t depth;
+    uint64_t direction_code;
+} menu_engine_event;
+
+/*
+    Menus are loaded from UTF-8 text in the format described at parse_menu
+    in MenuEngine.h. On a parse error, *error_line receives the 1-based line
+    number of the offending line.
+
+    Publishing replaces the tree for sessions begun afterwards; sessions in
+    progress keep the tree they began with. A menu may be published to from
+    one thread while sessions run on others. All sessions must be destroyed
+    before their menu.
+*/
+MENU_ENGINE_API menu_engine_status menu_engine_menu_create(char const* text, size_t length, size_t* error_line, menu_engine_menu** out_menu);
+MENU_ENGINE_API menu_engine_status menu_engine_menu_publish(menu_engine_menu* menu, char const* text, size_t length, size_t* error_line);
+MENU_ENGINE_API void menu_engine_menu_destroy(menu_engine_menu* menu);
+
+/*
+    A session is one pointer gesture at a time: begin pins the current tree
+    and resets the pointer to the center, end releases the tree. A session
+    must only be used by one thread at a time. Passing a null session
+    returns MENU_ENGINE_INVALID_ARGUMENT.
+*/
+MENU_ENGINE_API menu_engine_session* menu_engine_session_create(menu_engine_menu* menu);
+MENU_ENGINE_API void menu_engine_session_destroy(menu_engine_session* session);
+MENU_ENGINE_API menu_engine_status menu_engine_session_begin(menu_engine_session* session);
+MENU_ENGINE_API menu_engine_status menu_engine_session_end(menu_engine_session* session);
+
+/*
+    Applies n pointer deltas, stored as interleaved x, y pairs in xy, and
+    returns the number of events written to events_out, which must have room
+    for n events. Does nothing and returns 0 outside of begin/end, for a
+    null session, and for null xy or events_out when n is not 0.
+*/
+MENU_ENGINE_API size_t menu_engine_apply_deltas(menu_engine_session* session, float const* xy, size_t n, menu_engine_event* events_out);
+
+/*
+    Returns the direction code of the selected item, 0 if there is none or
+    the session is null.
+*/
+MENU_ENGINE_API uint64_t menu_engine_session_selected(menu_engine_session const* session);
+
+/*
+    Writes the NUL-terminated UTF-8 description of the selected item, or an
+    empty string if there is none. *out_length receives the length without
+    the terminator even if the buffer is too small.
+*/
+MENU_ENGINE_API menu_engine_status menu_engine_session_selected_name(menu_engine_session const* session, char* buffer, size_t size, size_t* out_length);
+
+#ifdef __cplusplus
+}
+#endif
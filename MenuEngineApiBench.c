@@ -0,0 +1,167 @@
+/* MenuEngineApiBench.c : Cost per event of menu_engine_apply_deltas at different batch sizes, driven through the C interface. */
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "MenuEngineApi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/*
+    Usage:
+
+        MenuEngineApiBench [deltas] [menu file]
+
+    Feeds the same pseudo-random deltas through one session in batches of 1,
+    64 and 4096 and reports the cost per delta. The deltas form out-and-back
+    gestures of gesture_length deltas: a random walk away from the center
+    followed by the same walk in reverse, so the pointer keeps opening and
+    closing branches instead of drifting off, and batches run across
+    gesture boundaries. Without a menu file every top-level sector holds a
+    binary submenu of depth generated_depth.
+*/
+
+#define gesture_length 256
+#define generated_depth 4
+
+static double now_seconds(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+#endif
+}
+
+static uint64_t rng_state = 1;
+
+static uint64_t next_random(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static size_t append_items(char* text, size_t length, char const* name, int indent, int depth) {
+    length += (size_t)sprintf(text + length, "%*s%s\n", 2 * indent, "", name);
+    if (depth > 0) {
+        char child[64];
+        sprintf(child, "%sa", name);
+        length = append_items(text, length, child, indent + 1, depth - 1);
+        sprintf(child, "%sb", name);
+        length = append_items(text, length, child, indent + 1, depth - 1);
+    }
+    return length;
+}
+
+static char* generate_menu(size_t* out_length) {
+    char* text = (char*)malloc((size_t)64 << (generated_depth + 4));
+    size_t length = 0;
+    for (int i = 0; i < 8; ++i) {
+        char name[8];
+        sprintf(name, "s%d", i);
+        length = append_items(text, length, name, 0, generated_depth);
+    }
+    *out_length = length;
+    return text;
+}
+
+static char* read_menu(char const* path, size_t* out_length) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    size_t capacity = 1 << 16;
+    size_t length = 0;
+    char* text = (char*)malloc(capacity);
+    size_t n;
+    while ((n = fread(text + length, 1, capacity - length, file)) > 0) {
+        length += n;
+        if (length == capacity) {
+            capacity *= 2;
+            text = (char*)realloc(text, capacity);
+        }
+    }
+    fclose(file);
+    *out_length = length;
+    return text;
+}
+
+int main(int argc, char** argv) {
+    size_t delta_count = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 1000000;
+    size_t length = 0;
+    char* text = argc > 2 ? read_menu(argv[2], &length) : generate_menu(&length);
+    if (!text) {
+        fprintf(stderr, "cannot read %s\n", argv[2]);
+        return 1;
+    }
+    delta_count -= delta_count % gesture_length;
+    if (delta_count == 0) {
+        delta_count = gesture_length;
+    }
+
+    size_t error_line = 0;
+    menu_engine_menu* menu = NULL;
+    if (menu_engine_menu_create(text, length, &error_line, &menu) != MENU_ENGINE_OK) {
+        fprintf(stderr, "malformed menu at line %zu\n", error_line);
+        return 1;
+    }
+    menu_engine_session* session = menu_engine_session_create(menu);
+
+    /*
+        Deltas are multiples of 1/4, so the way back ends exactly at the
+        center.
+    */
+    float* xy = (float*)malloc(2 * delta_count * sizeof(float));
+    for (size_t g = 0; g < delta_count; g += gesture_length) {
+        size_t half = gesture_length / 2;
+        float dx = (float)(next_random() % 17) - 8.0f;
+        float dy = (float)(next_random() % 17) - 8.0f;
+        for (size_t i = 0; i < half; ++i) {
+            dx += 0.25f * ((float)(next_random() % 9) - 4.0f);
+            dy += 0.25f * ((float)(next_random() % 9) - 4.0f);
+            xy[2 * (g + i)] = dx;
+            xy[2 * (g + i) + 1] = dy;
+            xy[2 * (g + gesture_length - 1 - i)] = -dx;
+            xy[2 * (g + gesture_length - 1 - i) + 1] = -dy;
+        }
+    }
+    menu_engine_event* events = (menu_engine_event*)malloc(4096 * sizeof(menu_engine_event));
+
+    size_t const batch_sizes[] = {1, 64, 4096};
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); ++b) {
+            size_t batch = batch_sizes[b];
+            size_t event_count = 0;
+            menu_engine_session_begin(session);
+            double start = now_seconds();
+            for (size_t i = 0; i < delta_count; i += batch) {
+                size_t n = i + batch < delta_count ? batch : delta_count - i;
+                event_count += menu_engine_apply_deltas(session, xy + 2 * i, n, events);
+            }
+            double seconds = now_seconds() - start;
+            menu_engine_session_end(session);
+            if (pass == 1) {
+                printf("batch %4zu: %6.2f ns per delta, %zu deltas, %zu events\n", batch, 1e9 * seconds / (double)delta_count, delta_count, event_count);
+            }
+        }
+    }
+
+    free(events);
+    free(xy);
+    menu_engine_session_destroy(session);
+    menu_engine_menu_destroy(menu);
+    free(text);
+    return 0;
+}
@@ -0,0 +1,1295 @@
+// MenuEngineDaemon.cpp : Hosts one menu engine for many client processes.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "MenuClip.h"
+#include "MenuEngine.h"
+#include "MenuEngineGesture.h"
+#include "MenuEngineInput.h"
+#include "MenuEnginePerf.h"
+#include "MenuEngineShm.h"
+#include "MenuPaint.h"
+#include "MenuScene.h"
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <afunix.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+    Usage:
+
+        MenuEngineDaemon serve <socket path> <menu file>
+        MenuEngineDaemon bench <socket path> <menu file> [clients] [deltas per client] [window] [polling hz]
+        MenuEngineDaemon profile <menu file> [deltas] [polling hz]
+
+    serve loads a menu in the format described at parse_menu and accepts
+    clients on a Unix domain socket, see MenuEngineShm.h for the protocol.
+    Every client gets its own session and thread; all sessions share the one
+    published tree. Since every client thread spins while its client is
+    active, at most shm_max_clients clients are served at a time and any
+    further ones are turned away.
+
+    bench is the matching load generator. Each client thread sends strokes
+    from gesture_generator_t, keeps up to window requests in flight and
+    reports the round-trip latency from pushing a request to seeing the
+    state record that acknowledges it, and how many strokes selected the
+    leaf they aimed at. A window of 1 measures the bare round trip, a large
+    window measures throughput.
+
+    profile runs the engine's core routines in process over the same kind
+    of strokes, without the daemon, and reports the time per call together
+    with hardware counters per call where perf_counters_t can open them.
+    Before timing anything it replays the strokes on menu_state_t and
+    fixed_menu_state_t side by side and stops with exit code 1 unless both
+    reach the same branch stack after every delta.
+    It then measures input_queue_t between two threads, once with the
+    producer pushing as fast as it can and once paced at the polling rate,
+    and reports the latency from stamping an event to draining it. Last it
+    builds leaf_index_t over a generated menu of about a million leaves and
+    times the build and lookups of every leaf by code and by item, and
+    compares the same 512 leaves laid out as binary and as 8-ary submenus,
+    including what a frame of ContextMenuTest.cpp draws after each delta.
+    It records a session of a million deltas in session_history_t, checks
+    every snapshot against a forward replay and reports the memory the
+    history takes and the time per recorded delta and per restore. It also
+    records a Zipf-distributed selection trace on the given menu,
+    and on a generated one whose leaves sit at depths 1 to 8, and reports
+    the expected depth and events per selection before and after
+    relayout_step has settled.
+*/
+
+#if defined(_WIN32)
+typedef SOCKET socket_t;
+socket_t const invalid_socket = INVALID_SOCKET;
+typedef WSAPOLLFD pollfd_t;
+static int poll_sockets(pollfd_t* fds, unsigned long n, int timeout_ms) { return WSAPoll(fds, n, timeout_ms); }
+static void close_socket(socket_t s) { closesocket(s); }
+static void remove_socket_path(char const* path) { DeleteFileA(path); }
+static int const send_flags = 0;
+#else
+typedef int socket_t;
+socket_t const invalid_socket = -1;
+typedef pollfd pollfd_t;
+static int poll_sockets(pollfd_t* fds, nfds_t n, int timeout_ms) { return poll(fds, n, timeout_ms); }
+static void close_socket(socket_t s) { close(s); }
+static void remove_socket_path(char const* path) { unlink(path); }
+static int const send_flags = MSG_NOSIGNAL;
+#endif
+
+/*
+    The daemon waits on a ring by spinning with a pause hint only, it never
+    yields or sleeps there, so that its data path makes no system calls; a
+    client thread that stays idle goes to sleep through sleeping instead,
+    see client_session_t.
+
+    The load generator and the profile threads may share a core with the
+    thread they wait for, so backoff_wait spins for pause_rounds and then
+    yields the processor. round counts the consecutive waits.
+*/
+static uint32_t const pause_rounds = 256;
+
+static void spin_wait() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+    _mm_pause();
+#endif
+}
+
+static void backoff_wait(uint32_t round) {
+    if (round < pause_rounds) {
+        spin_wait();
+    } else {
+        std::this_thread::yield();
+    }
+}
+
+struct shared_memory_t {
+    std::string name;
+    shm_channel_t* channel = nullptr;
+    bool created = false;
+#if defined(_WIN32)
+    HANDLE mapping = nullptr;
+#endif
+
+    bool create(std::string const& shm_name) {
+        name = shm_name;
+#if defined(_WIN32)
+        mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(shm_channel_t), name.c_str());
+        if (!mapping || GetLastError() == ERROR_ALREADY_EXISTS) {
+            close();
+            return false;
+        }
+        void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(shm_channel_t));
+#else
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        void* view = nullptr;
+        if (ftruncate(fd, sizeof(shm_channel_t)) == 0) {
+            view = mmap(nullptr, sizeof(shm_channel_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            view = view == MAP_FAILED ? nullptr : view;
+        }
+        ::close(fd);
+        if (!view) {
+            shm_unlink(name.c_str());
+        }
+#endif
+        if (!view) {
+            close();
+            return false;
+        }
+        channel = new (view) shm_channel_t{};
+        channel->magic = shm_channel_magic;
+        channel->version = shm_channel_version;
+        created = true;
+        return true;
+    }
+
+    bool open(std::string const& shm_name) {
+        name = shm_name;
+#if defined(_WIN32)
+        mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+        void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(shm_channel_t)) : nullptr;
+#else
+        void* view = nullptr;
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd >= 0) {
+            view = mmap(nullptr, sizeof(shm_channel_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            view = view == MAP_FAILED ? nullptr : view;
+            ::close(fd);
+        }
+#endif
+        channel = (shm_channel_t*)view;
+        if (!channel || channel->magic != shm_channel_magic || channel->version != shm_channel_version) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /*
+        Only the side whose create succeeded unlinks the name, a failed
+        create leaves a name that belongs to someone else alone. The memory
+        itself stays valid until the other side unmaps it as well.
+    */
+    void close() {
+#if defined(_WIN32)
+        if (channel) {
+            UnmapViewOfFile(channel);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        mapping = nullptr;
+#else
+        if (channel) {
+            munmap(channel, sizeof(shm_channel_t));
+        }
+        if (created) {
+            shm_unlink(name.c_str());
+        }
+#endif
+        channel = nullptr;
+        created = false;
+    }
+};
+
+static std::string channel_name(uint32_t id) {
+    char name[64];
+#if defined(_WIN32)
+    snprintf(name, sizeof(name), "Local\\menu_engine_%lu_%u", GetCurrentProcessId(), id);
+#else
+    snprintf(name, sizeof(name), "/menu_engine_%ld_%u", (long)getpid(), id);
+#endif
+    return name;
+}
+
+static bool make_socket_address(char const* path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strcpy(address.sun_path, path);
+    return true;
+}
+
+static bool send_all(socket_t s, char const* data, size_t size) {
+    while (size > 0) {
+        int sent = send(s, data, (int)std::min<size_t>(size, 1 << 20), send_flags);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool send_line(socket_t s, std::string line) {
+    line.push_back('\n');
+    return send_all(s, line.data(), line.size());
+}
+
+static bool receive_line(socket_t s, std::string& line) {
+    line.clear();
+    char c;
+    while (recv(s, &c, 1, 0) == 1) {
+        if (c == '\n') {
+            return true;
+        }
+        line.push_back(c);
+    }
+    return false;
+}
+
+/*
+    Daemon side.
+*/
+
+static menu_rcu_t menu_rcu;
+
+/*
+    A client thread spins on its request ring while deltas arrive and only
+    falls back to blocking in poll on the control socket, without a timeout,
+    once the ring has been empty for idle_spin_rounds waits. The client
+    wakes it for the first request after such a pause, see sleeping in
+    MenuEngineShm.h; during a gesture the data path makes no system calls.
+    While busy, the control socket is still checked every
+    control_check_interval batches so that publish and hangup are noticed.
+*/
+static uint32_t const idle_spin_rounds = 1 << 14;
+static uint32_t const control_check_interval = 1024;
+
+struct client_session_t {
+    socket_t socket;
+    shared_memory_t shm;
+    std::string control_buffer;
+    menu_rcu_t::reader_t* reader;
+    fixed_menu_state_t state;
+    bool is_active = false;
+
+    /*
+        Returns false once the client has closed the socket or sent a
+        message over the limits in MenuEngineShm.h, which ends the session.
+    */
+    bool handle_control(int timeout_ms) {
+        pollfd_t fd{};
+        fd.fd = socket;
+        fd.events = POLLIN;
+        int ready = poll_sockets(&fd, 1, timeout_ms);
+        if (ready < 0) {
+            return false;
+        }
+        if (ready == 0) {
+            return true;
+        }
+        char chunk[4096];
+        int received = recv(socket, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            return false;
+        }
+        control_buffer.append(chunk, received);
+        for (;;) {
+            size_t line_end = control_buffer.find('\n');
+            if (line_end == std::string::npos) {
+                if (control_buffer.size() > shm_max_control_line) {
+                    send_line(socket, "error 0");
+                    return false;
+                }
+                return true;
+            }
+            std::string line = control_buffer.substr(0, line_end);
+            if (line.empty()) {
+                control_buffer.erase(0, line_end + 1);
+                continue;
+            }
+            if (line.compare(0, 8, "publish ") != 0) {
+                control_buffer.erase(0, line_end + 1);
+                if (!send_line(socket, "error 0")) {
+                    return false;
+                }
+                continue;
+            }
+            size_t length = strtoull(line.c_str() + 8, nullptr, 10);
+            if (length > shm_max_publish_bytes) {
+                send_line(socket, "error 0");
+                return false;
+            }
+            if (control_buffer.size() - line_end - 1 < length) {
+                return true;
+            }
+            std::wstring text = utf8_to_wstring(control_buffer.data() + line_end + 1, length);
+            control_buffer.erase(0, line_end + 1 + length);
+            size_t error_line = 0;
+            std::unique_ptr<menu_tree_t> tree = parse_menu(text, error_line);
+            std::string reply = "ok";
+            if (tree) {
+                menu_rcu.publish(std::move(tree));
+            } else {
+                reply = "error " + std::to_string(error_line);
+            }
+            if (!send_line(socket, reply)) {
+                return false;
+            }
+        }
+    }
+
+    /*
+        Blocks until the client sends a control message or wakes this
+        thread for a new request. Returns false once the client has closed
+        the socket.
+    */
+    bool sleep() {
+        std::atomic<uint32_t>& sleeping = shm.channel->sleeping;
+        sleeping.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool open = shm.channel->requests.available() != 0 || handle_control(-1);
+        sleeping.store(0, std::memory_order_relaxed);
+        return open;
+    }
+
+    /*
+        Only a client that keeps more than shm_request_capacity requests in
+        flight fills the response ring; the control socket is checked every
+        control_check_interval waits so that its hangup is still noticed.
+    */
+    bool push_response(shm_response_t const& response) {
+        for (uint32_t round = 1; !shm.channel->responses.try_push(response); ++round) {
+            if (round % control_check_interval == 0 && !handle_control(0)) {
+                return false;
+            }
+            spin_wait();
+        }
+        return true;
+    }
+
+    bool process_requests(uint32_t n) {
+        auto& requests = shm.channel->requests;
+        menu_item_t* last_item = state.selected_leaf_item();
+        for (uint32_t i = 0; i < n; ++i) {
+            shm_request_t const& request = requests.peek(i);
+            switch (request.kind) {
+            case shm_request_kind::begin:
+                if (is_active) {
+                    menu_rcu.unpin(reader);
+                }
+                state.reset(menu_rcu.pin(reader));
+                is_active = true;
+                break;
+            case shm_request_kind::delta:
+                if (is_active) {
+                    state.apply_delta(vec2{request.x, request.y});
+                }
+                break;
+            case shm_request_kind::end:
+                if (is_active) {
+                    menu_rcu.unpin(reader);
+                    state.reset(nullptr);
+                    is_active = false;
+                }
+                break;
+            }
+            menu_item_t* item = state.selected_leaf_item();
+            if (item != last_item) {
+                last_item = item;
+                if (!push_response(shm_response_t{shm_response_kind::selection, request.seq, (uint32_t)state.branches.size(), 0, state.direction_code()})) {
+                    return false;
+                }
+            }
+        }
+        uint32_t last_seq = requests.peek(n - 1).seq;
+        requests.consume(n);
+        return push_response(shm_response_t{shm_response_kind::state, last_seq, (uint32_t)state.branches.size(), 0, state.direction_code()});
+    }
+
+    void run() {
+        auto& requests = shm.channel->requests;
+        uint32_t idle_rounds = 0;
+        uint32_t busy_batches = 0;
+        for (;;) {
+            uint32_t n = requests.available();
+            if (n != 0) {
+                idle_rounds = 0;
+                if (!process_requests(n)) {
+                    return;
+                }
+                busy_batches += 1;
+                if (busy_batches % control_check_interval != 0) {
+                    continue;
+                }
+            } else if (idle_rounds < idle_spin_rounds) {
+                spin_wait();
+                idle_rounds += 1;
+                continue;
+            }
+            if (!(n != 0 ? handle_control(0) : sleep())) {
+                return;
+            }
+        }
+    }
+};
+
+static std::atomic<uint32_t> client_count{0};
+
+static void serve_client(socket_t socket, uint32_t id) {
+    client_session_t session;
+    session.socket = socket;
+    if (session.shm.create(channel_name(id)) && send_line(socket, "channel " + session.shm.name)) {
+        session.reader = menu_rcu.acquire_reader();
+        session.state.reset(nullptr);
+        session.run();
+        if (session.is_active) {
+            menu_rcu.unpin(session.reader);
+        }
+        menu_rcu.release_reader(session.reader);
+    }
+    session.shm.close();
+    close_socket(socket);
+    client_count.fetch_sub(1);
+}
+
+static bool read_file(char const* path, std::string& contents) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        contents.append(chunk, n);
+    }
+    fclose(file);
+    return true;
+}
+
+static int serve(char const* socket_path, char const* menu_path) {
+    std::string text;
+    if (!read_file(menu_path, text)) {
+        fprintf(stderr, "cannot read %s\n", menu_path);
+        return 1;
+    }
+    size_t error_line = 0;
+    std::unique_ptr<menu_tree_t> tree = parse_menu(utf8_to_wstring(text.data(), text.size()), error_line);
+    if (!tree) {
+        fprintf(stderr, "%s:%zu: malformed menu\n", menu_path, error_line);
+        return 1;
+    }
+    menu_rcu.publish(std::move(tree));
+
+    sockaddr_un address;
+    if (!make_socket_address(socket_path, address)) {
+        fprintf(stderr, "socket path too long\n");
+        return 1;
+    }
+    remove_socket_path(socket_path);
+    socket_t listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == invalid_socket || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        fprintf(stderr, "cannot listen on %s\n", socket_path);
+        return 1;
+    }
+    uint32_t next_id = 0;
+    for (;;) {
+        socket_t client = accept(listener, nullptr, nullptr);
+        if (client == invalid_socket) {
+            continue;
+        }
+        if (client_count.load() >= shm_max_clients) {
+            send_line(client, "busy");
+            close_socket(client);
+            continue;
+        }
+        client_count.fetch_add(1);
+        std::thread(serve_client, client, next_id).detach();
+        next_id += 1;
+    }
+}
+
+/*
+    Load generator side.
+*/
+
+struct bench_result_t {
+    bool ok = false;
+    uint64_t requests = 0;
+    uint64_t selections = 0;
+    uint64_t gestures = 0;
+    uint64_t hits = 0;
+    std::vector<float> round_trips_us;
+};
+
+/*
+    Strokes come from gesture_generator_t aimed at random leaves of the
+    menu, which must be the one the daemon serves. A stroke counts as a hit
+    when the item selected just before its end request is the leaf it aimed
+    at.
+*/
+static void run_bench_client(char const* socket_path, leaf_index_t const* leaf_index, gesture_params_t gesture_params, uint64_t delta_count, uint32_t window, uint32_t seed, bench_result_t& result) {
+    typedef std::chrono::steady_clock clock;
+    struct pending_gesture_t {
+        uint32_t end_seq;
+        direction_code_t code;
+    };
+
+    sockaddr_un address;
+    socket_t s = socket(AF_UNIX, SOCK_STREAM, 0);
+    std::string line;
+    shared_memory_t shm;
+    if (s == invalid_socket || !make_socket_address(socket_path, address) || connect(s, (sockaddr*)&address, sizeof(address)) != 0
+        || !receive_line(s, line) || line.compare(0, 8, "channel ") != 0 || !shm.open(line.substr(8))) {
+        if (s != invalid_socket) {
+            close_socket(s);
+        }
+        return;
+    }
+    auto& requests = shm.channel->requests;
+    auto& responses = shm.channel->responses;
+    std::vector<clock::time_point> send_times(shm_request_capacity);
+    result.round_trips_us.reserve(window == 1 ? delta_count + delta_count / 64 : delta_count / 16);
+
+    gesture_generator_t generator;
+    generator.reset(*leaf_index, gesture_params, seed);
+    std::vector<vec2> deltas;
+    size_t next_delta = 1;
+    direction_code_t target_code = 0;
+    std::vector<pending_gesture_t> pending;
+    size_t pending_begin = 0;
+    direction_code_t selected_code = 0;
+    uint32_t seq = 0;
+    uint32_t acked = 0;
+    uint64_t sent_deltas = 0;
+    uint32_t wait_round = 0;
+    window = std::min(window, shm_request_capacity);
+
+    auto drain = [&]() {
+        uint32_t n = responses.available();
+        clock::time_point now = clock::now();
+        for (uint32_t i = 0; i < n; ++i) {
+            shm_response_t const& response = responses.peek(i);
+            while (pending_begin < pending.size() && (int32_t)(response.seq - pending[pending_begin].end_seq) >= 0) {
+                result.hits += selected_code == pending[pending_begin].code;
+                pending_begin += 1;
+            }
+            selected_code = response.direction_code;
+            if (response.kind == shm_response_kind::selection) {
+                result.selections += 1;
+                continue;
+            }
+            float us = std::chrono::duration<float, std::micro>(now - send_times[response.seq & (shm_request_capacity - 1)]).count();
+            result.round_trips_us.push_back(us);
+            acked = response.seq + 1;
+        }
+        responses.consume(n);
+        if (pending_begin == pending.size()) {
+            pending.resize(0);
+            pending_begin = 0;
+        }
+    };
+
+    while (sent_deltas < delta_count || next_delta <= deltas.size() || acked != seq) {
+        bool finished = sent_deltas >= delta_count && next_delta > deltas.size();
+        if (finished || seq - acked >= window) {
+            uint32_t before = acked;
+            drain();
+            wait_round = acked != before ? 0 : wait_round + 1;
+            if (wait_round != 0) {
+                backoff_wait(wait_round);
+            }
+            continue;
+        }
+        shm_request_t request{shm_request_kind::delta, seq, 0.0f, 0.0f};
+        if (next_delta > deltas.size()) {
+            deltas.resize(0);
+            target_code = generator.generate(deltas).code;
+            next_delta = 0;
+            request.kind = shm_request_kind::begin;
+            result.gestures += 1;
+        } else if (next_delta == deltas.size()) {
+            request.kind = shm_request_kind::end;
+            pending.push_back(pending_gesture_t{seq, target_code});
+            next_delta += 1;
+        } else {
+            request.x = deltas[next_delta].x;
+            request.y = deltas[next_delta].y;
+            next_delta += 1;
+            sent_deltas += 1;
+        }
+        send_times[seq & (shm_request_capacity - 1)] = clock::now();
+        requests.try_push(request);
+        std::atomic<uint32_t>& sleeping = shm.channel->sleeping;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed) != 0 && sleeping.exchange(0, std::memory_order_relaxed) != 0 && !send_all(s, "\n", 1)) {
+            shm.close();
+            close_socket(s);
+            return;
+        }
+        seq += 1;
+    }
+    result.requests = seq;
+    result.ok = true;
+    shm.close();
+    close_socket(s);
+}
+
+static int bench(char const* socket_path, char const* menu_path, uint32_t clients, uint64_t delta_count, uint32_t window, float polling_hz) {
+    std::string text;
+    if (!read_file(menu_path, text)) {
+        fprintf(stderr, "cannot read %s\n", menu_path);
+        return 1;
+    }
+    size_t error_line = 0;
+    std::unique_ptr<menu_tree_t> tree = parse_menu(utf8_to_wstring(text.data(), text.size()), error_line);
+    if (!tree) {
+        fprintf(stderr, "%s:%zu: malformed menu\n", menu_path, error_line);
+        return 1;
+    }
+    leaf_index_t leaf_index;
+    if (!leaf_index.build(*tree)) {
+        fprintf(stderr, "%s: some leaves are nested too deeply for a direction code\n", menu_path);
+        return 1;
+    }
+    gesture_params_t gesture_params;
+    gesture_params.polling_hz = polling_hz;
+
+    std::vector<bench_result_t> results(clients);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < clients; ++i) {
+        threads.emplace_back(run_bench_client, socket_path, &leaf_index, gesture_params, delta_count, window, i, std::ref(results[i]));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t total_requests = 0;
+    uint64_t total_selections = 0;
+    uint64_t total_gestures = 0;
+    uint64_t total_hits = 0;
+    std::vector<float> round_trips;
+    for (bench_result_t& result : results) {
+        if (!result.ok) {
+            fprintf(stderr, "client failed to connect\n");
+            return 1;
+        }
+        total_requests += result.requests;
+        total_selections += result.selections;
+        total_gestures += result.gestures;
+        total_hits += result.hits;
+        round_trips.insert(round_trips.end(), result.round_trips_us.begin(), result.round_trips_us.end());
+    }
+    std::sort(round_trips.begin(), round_trips.end());
+    auto percentile = [&round_trips](double p) {
+        return round_trips.size() != 0 ? round_trips[std::min(round_trips.size() - 1, (size_t)(p * round_trips.size()))] : 0.0f;
+    };
+    printf("clients %u, window %u: %.0f requests/s, %.0f selections/s\n", clients, window, total_requests / seconds, total_selections / seconds);
+    printf("round trip us: p50 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n", percentile(0.5), percentile(0.99), percentile(0.999), percentile(1.0));
+    printf("gestures %llu, hit rate %.4f\n", (unsigned long long)total_gestures, total_gestures ? (double)total_hits / total_gestures : 0.0);
+    return 0;
+}
+
+/*
+    Engine micro-benchmarks.
+*/
+
+static volatile float profile_sink;
+
+/*
+    Runs body once to warm the caches and the branch predictors, then once
+    more measured. ops is the number of calls body makes.
+*/
+template<typename body_t>
+static void profile_run(char const* name, uint64_t ops, perf_counters_t& counters, bool counting, body_t&& body) {
+    body();
+    auto start = std::chrono::steady_clock::now();
+    if (counting) {
+        counters.start();
+    }
+    body();
+    if (counting) {
+        counters.stop();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%-18s %8.2f ns/op", name, ns / ops);
+    if (counting) {
+        for (int i = 0; i < perf_counters_t::count; ++i) {
+            if (counters.available[i]) {
+                printf(", %s %.3f", perf_counters_t::name(i), (double)counters.values[i] / ops);
+            }
+        }
+        if (counters.available[0] && counters.available[1] && counters.values[0] != 0) {
+            printf(", IPC %.2f", (double)counters.values[1] / counters.values[0]);
+        }
+    }
+    printf("\n");
+}
+
+static input_queue_t<4096> profile_input_queue;
+
+/*
+    The producer pushes event_count deltas of one unit, every 1 / rate_hz
+    seconds or back to back if rate_hz is 0, and a button transition every
+    25 ms, more than anyone clicks. The consumer checks that the deltas add
+    up and that every transition arrives.
+*/
+static void profile_input(char const* name, uint64_t event_count, float rate_hz) {
+    input_queue_t<4096>& queue = profile_input_queue;
+    queue.reset();
+    std::atomic<bool> done{false};
+    std::vector<float> latencies_us;
+    latencies_us.reserve(event_count);
+    uint64_t received = 0;
+    float sum = 0;
+    uint64_t transitions = 0;
+    uint64_t transitions_sent = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer([&queue, &done, &transitions_sent, event_count, rate_hz]() {
+        uint64_t period_ns = rate_hz > 0 ? (uint64_t)(1e9 / rate_hz) : 0;
+        uint64_t next_ns = input_time_ns();
+        uint64_t next_transition_ns = next_ns;
+        for (uint64_t i = 0; i < event_count; ++i) {
+            if (period_ns != 0) {
+                for (uint32_t round = 0; input_time_ns() < next_ns; ++round) {
+                    backoff_wait(round);
+                }
+                next_ns += period_ns;
+            }
+            queue.push(input_event_t{input_event_kind::delta, 0, input_time_ns(), vec2{1.0f, 0.0f}});
+            uint64_t now_ns = input_time_ns();
+            if (now_ns >= next_transition_ns) {
+                input_event_kind kind = transitions_sent % 2 == 0 ? input_event_kind::button_down : input_event_kind::button_up;
+                queue.push(input_event_t{kind, input_button_left, now_ns, vec2{0.0f, 0.0f}});
+                transitions_sent += 1;
+                next_transition_ns = now_ns + 25000000;
+            }
+        }
+        for (uint32_t round = 0; !queue.flush(); ++round) {
+            backoff_wait(round);
+        }
+        done.store(true, std::memory_order_release);
+    });
+    for (uint32_t round = 0;;) {
+        bool finished = done.load(std::memory_order_acquire);
+        uint64_t now_ns = input_time_ns();
+        uint32_t n = queue.drain([&](input_event_t const& event) {
+            latencies_us.push_back((float)(now_ns - event.time_ns) * 1e-3f);
+            sum += event.delta.x;
+            transitions += event.kind != input_event_kind::delta;
+        });
+        received += n;
+        if (n == 0 && finished) {
+            break;
+        }
+        round = n != 0 ? 0 : round + 1;
+        if (round != 0) {
+            backoff_wait(round);
+        }
+    }
+    producer.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+    auto percentile = [&latencies_us](double p) {
+        return latencies_us.size() != 0 ? latencies_us[std::min(latencies_us.size() - 1, (size_t)(p * latencies_us.size()))] : 0.0f;
+    };
+    printf("%-18s %.0f events/s, %llu received, %llu coalesced, %llu dropped, delta %s, transitions %s\n", name, event_count / seconds,
+        (unsigned long long)received, (unsigned long long)queue.coalesced.load(), (unsigned long long)queue.dropped.load(),
+        sum == (float)event_count ? "exact" : "lost", transitions == transitions_sent ? "exact" : "lost");
+    printf("%-18s latency us: p50 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n", "", percentile(0.5), percentile(0.99), percentile(0.999), percentile(1.0));
+}
+
+static menu_item_t profile_item(int width, int depth) {
+    if (depth == 0) {
+        return menu_item_t::leaf(std::wstring());
+    }
+    std::vector<menu_item_t> children;
+    for (int i = 0; i < width; ++i) {
+        children.push_back(profile_item(width, depth - 1));
+    }
+    return menu_item_t{std::wstring(), menu_item_t::submenu_t::make(std::move(children))};
+}
+
+/*
+    Every top-level item holds a binary submenu of the given depth, so the
+    tree has 8 << depth leaves. The lookups visit every leaf once, in random
+    order. Returns false if a lookup does not find its leaf.
+*/
+static bool profile_index(int depth, perf_counters_t& counters, bool counting) {
+    auto tree = std::make_unique<menu_tree_t>();
+    for (int i = 0; i < 8; ++i) {
+        tree->root[i] = profile_item(2, depth);
+    }
+    leaf_index_t leaf_index;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = leaf_index.build(*tree);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("%-18s %8.2f ms, %zu leaves, %zu waypoints\n", "index build", ms, leaf_index.leaves.size(), leaf_index.waypoints.size());
+
+    std::vector<size_t> order(leaf_index.leaves.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(0));
+    std::vector<direction_code_t> codes;
+    std::vector<menu_item_t const*> items;
+    for (size_t i : order) {
+        codes.push_back(leaf_index.leaves[i].code);
+        items.push_back(leaf_index.leaves[i].menu_item_ptr);
+    }
+    size_t found = 0;
+    profile_run("index find code", codes.size(), counters, counting, [&]() {
+        found = 0;
+        for (direction_code_t code : codes) {
+            leaf_index_t::leaf_t const* leaf = leaf_index.find(code);
+            found += leaf && leaf->code == code;
+        }
+    });
+    ok = ok && found == codes.size();
+    profile_run("index find item", items.size(), counters, counting, [&]() {
+        found = 0;
+        for (menu_item_t const* item : items) {
+            leaf_index_t::leaf_t const* leaf = leaf_index.find(item);
+            found += leaf && leaf->menu_item_ptr == item;
+        }
+    });
+    ok = ok && found == items.size();
+    if (!ok) {
+        fprintf(stderr, "index lookup failed\n");
+    }
+    return ok;
+}
+
+/*
+    Frame cost without a window: the scene commands ContextMenuTest.cpp
+    draws for a state, in a 1280 by 800 window centered on the menu,
+    clipped and batched the way WM_PAINT does and counted by
+    paint_recorder_t. Labels measure 8 by 16 pixels per character.
+*/
+struct profile_frame_t {
+    std::vector<paint_command_t> commands;
+    paint_batch_t batch;
+    uint64_t command_count = 0;
+    uint64_t state_changes = 0;
+    uint64_t draw_calls = 0;
+
+    void draw(menu_state_t const& state) {
+        menu_scene_style_t const style{1, 2, 3, 4, 5, 6, 7};
+        commands.resize(0);
+        menu_scene_commands(state, 640, 400, style, [](std::wstring const& str) {
+            return vec2{8.0f * (float)str.size(), 16.0f};
+        }, commands);
+        clip_rect_t clip_rect{-1.0f, -1.0f, 1281.0f, 801.0f};
+        clip_stats_t clip_stats{};
+        size_t n = clip_paint_commands(clip_rect, commands.data(), commands.size(), clip_stats);
+        batch.batch(commands.data(), n);
+        paint_recorder_t recorder;
+        batch.run(recorder);
+        command_count += n;
+        state_changes += recorder.state_changes;
+        draw_calls += recorder.draw_calls;
+    }
+};
+
+/*
+    Strokes from gesture_generator_t aimed at random leaves of a menu,
+    replayed on menu_state_t. depth is the number of branches open at the
+    end of a stroke, events the deltas it takes, commands, state changes
+    and draw calls what profile_frame_t draws after each delta and us the
+    engine time per stroke.
+*/
+static void profile_layout(char const* name, int width, int depth, float polling_hz) {
+    auto tree = std::make_unique<menu_tree_t>();
+    for (int i = 0; i < 8; ++i) {
+        tree->root[i] = profile_item(width, depth);
+    }
+    leaf_index_t leaf_index;
+    leaf_index.build(*tree);
+    gesture_params_t gesture_params;
+    gesture_params.polling_hz = polling_hz;
+    gesture_generator_t generator;
+    generator.reset(leaf_index, gesture_params, 0);
+
+    uint32_t const stroke_count = 2048;
+    std::vector<vec2> deltas;
+    std::vector<size_t> stroke_ends;
+    std::vector<direction_code_t> targets;
+    for (uint32_t i = 0; i < stroke_count; ++i) {
+        targets.push_back(generator.generate(deltas).code);
+        stroke_ends.push_back(deltas.size());
+    }
+
+    menu_state_t state;
+    profile_frame_t frame;
+    uint64_t depth_sum = 0;
+    uint32_t hits = 0;
+    size_t begin = 0;
+    for (uint32_t s = 0; s < stroke_count; ++s) {
+        state.reset(tree.get());
+        for (size_t i = begin; i < stroke_ends[s]; ++i) {
+            state.apply_delta(deltas[i]);
+            frame.draw(state);
+        }
+        depth_sum += state.branches.size();
+        hits += state.direction_code() == targets[s];
+        begin = stroke_ends[s];
+    }
+    double ns = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t codes = 0;
+        begin = 0;
+        for (size_t end : stroke_ends) {
+            state.reset(tree.get());
+            for (size_t i = begin; i < end; ++i) {
+                state.apply_delta(deltas[i]);
+            }
+            codes += state.direction_code();
+            begin = end;
+        }
+        profile_sink = (float)codes;
+        ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+    printf("%-18s %zu leaves, depth %.2f, %.1f events, %.2f us per selection, hit rate %.4f\n", name,
+        leaf_index.leaves.size(), (double)depth_sum / stroke_count, (double)deltas.size() / stroke_count,
+        ns * 1e-3 / stroke_count, (double)hits / stroke_count);
+    printf("%-18s per frame: %.1f commands, %.1f state changes, %.1f draw calls\n", "",
+        (double)frame.command_count / deltas.size(), (double)frame.state_changes / deltas.size(), (double)frame.draw_calls / deltas.size());
+}
+
+/*
+    Records one session of delta_count deltas: the strokes, each followed
+    by its way back to the center, so that the session keeps opening and
+    closing branches. Every snapshot is then restored and compared with the
+    state a forward replay reaches after the same number of deltas, and the
+    restores are timed once more in random order. Returns false on any
+    mismatch.
+*/
+static bool profile_history(menu_tree_t* tree, std::vector<vec2> const& deltas, std::vector<size_t> const& stroke_ends, size_t delta_count) {
+    std::vector<vec2> session;
+    session.reserve(delta_count);
+    size_t begin = 0;
+    for (size_t s = 0; session.size() < delta_count; s = (s + 1) % stroke_ends.size()) {
+        begin = s == 0 ? 0 : stroke_ends[s - 1];
+        for (size_t i = begin; i < stroke_ends[s] && session.size() < delta_count; ++i) {
+            session.push_back(deltas[i]);
+        }
+        for (size_t i = stroke_ends[s]; i-- > begin && session.size() < delta_count;) {
+            session.push_back(-deltas[i]);
+        }
+    }
+
+    menu_state_t state;
+    state.reset(tree);
+    session_history_t history;
+    history.reset(state);
+    auto start = std::chrono::steady_clock::now();
+    for (vec2 delta : session) {
+        history.apply_delta(state, delta);
+    }
+    double record_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    size_t bytes = history.nodes.size() * sizeof(session_history_t::node_t) + history.snapshots.size() * sizeof(session_history_t::snapshot_t);
+
+    menu_state_t forward;
+    forward.reset(tree);
+    menu_state_t restored;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < history.size(); ++i) {
+        if (i != 0) {
+            forward.apply_delta(session[i - 1]);
+        }
+        history.restore(i, restored);
+        mismatches += !same_menu_state(forward, restored);
+    }
+
+    std::vector<uint32_t> order(history.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = (uint32_t)i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(0));
+    start = std::chrono::steady_clock::now();
+    size_t depth_sum = 0;
+    for (uint32_t i : order) {
+        history.restore(i, restored);
+        depth_sum += restored.branches.size();
+    }
+    double restore_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    profile_sink = (float)depth_sum;
+
+    printf("%-18s %zu deltas, %.2f ns per delta, %.1f MB in %zu nodes and %zu snapshots, %.2f ns per restore, %zu mismatches\n", "history",
+        session.size(), record_ns / session.size(), bytes * 1e-6, history.nodes.size(), history.snapshots.size(), restore_ns / order.size(), mismatches);
+    if (mismatches != 0) {
+        fprintf(stderr, "session history does not match the forward replay\n");
+    }
+    return mismatches == 0;
+}
+
+/*
+    Strokes the generator needs for each selection of the trace, on the
+    layout of tree. Leaves are matched by their usage, which relayout_step
+    moves along with the leaf.
+*/
+static double profile_trace_events(menu_tree_t& tree, std::vector<leaf_usage_t const*> const& trace, float polling_hz) {
+    leaf_index_t leaf_index;
+    leaf_index.build(tree);
+    std::unordered_map<leaf_usage_t const*, size_t> leaf_numbers;
+    for (size_t i = 0; i < leaf_index.leaves.size(); ++i) {
+        leaf_numbers.emplace(leaf_index.leaves[i].menu_item_ptr->usage.get(), i);
+    }
+    gesture_params_t gesture_params;
+    gesture_params.polling_hz = polling_hz;
+    gesture_generator_t generator;
+    generator.reset(leaf_index, gesture_params, 0);
+    std::vector<vec2> deltas;
+    uint64_t events = 0;
+    for (leaf_usage_t const* usage : trace) {
+        deltas.resize(0);
+        generator.generate(leaf_numbers[usage], deltas);
+        events += deltas.size();
+    }
+    return (double)events / trace.size();
+}
+
+/*
+    Ranks the leaves of a clone of tree in random order, records
+    selection_count selections with Zipf-distributed frequencies by rank and
+    runs relayout_step the way ContextMenuTest.cpp does until it stops
+    moving leaves.
+*/
+static void profile_relayout(char const* name, menu_tree_t const& tree, uint32_t selection_count, float polling_hz) {
+    std::unique_ptr<menu_tree_t> layout = tree.clone();
+    for (relayout_leaf_t const& leaf : collect_relayout_leaves(*layout)) {
+        leaf.menu_item_ptr->usage = std::make_shared<leaf_usage_t>();
+    }
+    std::vector<relayout_leaf_t> leaves = collect_relayout_leaves(*layout);
+    std::mt19937_64 rng(0);
+    std::shuffle(leaves.begin(), leaves.end(), rng);
+    std::vector<double> weights;
+    for (size_t r = 0; r < leaves.size(); ++r) {
+        weights.push_back(1.0 / (double)(r + 1));
+    }
+    std::discrete_distribution<size_t> zipf(weights.begin(), weights.end());
+    std::vector<leaf_usage_t const*> trace;
+    for (uint32_t i = 0; i < selection_count; ++i) {
+        leaf_usage_t* usage = leaves[zipf(rng)].menu_item_ptr->usage.get();
+        usage->record(0);
+        trace.push_back(usage);
+    }
+
+    float depth_before = expected_depth(*layout);
+    double events_before = profile_trace_events(*layout, trace, polling_hz);
+    uint32_t steps = 0;
+    while (steps < 1000 && relayout_step(*layout, 1, 2.0f) != 0) {
+        steps += 1;
+    }
+    float depth_after = expected_depth(*layout);
+    double events_after = profile_trace_events(*layout, trace, polling_hz);
+    printf("%-18s %u selections over %zu leaves: expected depth %.2f -> %.2f in %u steps, %.1f -> %.1f events per selection\n", name,
+        selection_count, leaves.size(), depth_before, depth_after, steps, events_before, events_after);
+}
+
+static int profile(char const* menu_path, uint64_t delta_count, float polling_hz) {
+    std::string text;
+    if (!read_file(menu_path, text)) {
+        fprintf(stderr, "cannot read %s\n", menu_path);
+        return 1;
+    }
+    size_t error_line = 0;
+    std::unique_ptr<menu_tree_t> tree = parse_menu(utf8_to_wstring(text.data(), text.size()), error_line);
+    if (!tree) {
+        fprintf(stderr, "%s:%zu: malformed menu\n", menu_path, error_line);
+        return 1;
+    }
+    leaf_index_t leaf_index;
+    if (!leaf_index.build(*tree)) {
+        fprintf(stderr, "%s: some leaves are nested too deeply for a direction code\n", menu_path);
+        return 1;
+    }
+    gesture_params_t gesture_params;
+    gesture_params.polling_hz = polling_hz;
+    gesture_generator_t generator;
+    generator.reset(leaf_index, gesture_params, 0);
+
+    /*
+        All strokes back to back; stroke_ends[i] is one past the last delta
+        of stroke i and positions holds the running position within each
+        stroke, which is what find_sector sees.
+    */
+    std::vector<vec2> deltas;
+    std::vector<size_t> stroke_ends;
+    std::vector<vec2> positions;
+    while (deltas.size() < delta_count) {
+        size_t begin = deltas.size();
+        generator.generate(deltas);
+        stroke_ends.push_back(deltas.size());
+        vec2 pos = vec2{0, 0};
+        for (size_t i = begin; i < deltas.size(); ++i) {
+            pos += deltas[i];
+            positions.push_back(pos);
+        }
+    }
+    uint64_t ops = deltas.size();
+
+    perf_counters_t counters;
+    bool counting = counters.open();
+    if (!counting) {
+        printf("hardware counters unavailable, timings only\n");
+    }
+    printf("%zu strokes, %llu deltas at %.0f Hz\n", stroke_ends.size(), (unsigned long long)ops, polling_hz);
+
+    menu_state_t runtime_state;
+    fixed_menu_state_t fixed_state;
+    size_t begin = 0;
+    for (size_t s = 0; s < stroke_ends.size(); ++s) {
+        runtime_state.reset(tree.get());
+        fixed_state.reset(tree.get());
+        for (size_t i = begin; i < stroke_ends[s]; ++i) {
+            runtime_state.apply_delta(deltas[i]);
+            fixed_state.apply_delta(deltas[i]);
+            if (!same_menu_state(runtime_state, fixed_state)) {
+                fprintf(stderr, "menu_state_t and fixed_menu_state_t differ at delta %zu of stroke %zu: depth %zu and %zu\n",
+                    i - begin, s, runtime_state.branches.size(), fixed_state.branches.size());
+                return 1;
+            }
+        }
+        begin = stroke_ends[s];
+    }
+
+    profile_run("operator%", ops, counters, counting, [&]() {
+        vec2 sum = vec2{0, 0};
+        for (size_t i = 0; i < deltas.size(); ++i) {
+            sum += rotor(i & 7) % deltas[i];
+        }
+        profile_sink = sum.x + sum.y;
+    });
+    profile_run("find_sector", ops, counters, counting, [&]() {
+        menu_state_t state;
+        state.reset(tree.get());
+        float sum = 0;
+        for (vec2 pos : positions) {
+            rotor rot;
+            vec2 relpos;
+            state.global_pos = pos;
+            state.find_sector(rot, relpos);
+            sum += (float)(uint8_t)rot + relpos.x;
+        }
+        profile_sink = sum;
+    });
+    auto replay = [&](auto& state, auto&& emit) {
+        uint64_t codes = 0;
+        size_t begin = 0;
+        for (size_t end : stroke_ends) {
+            state.reset(tree.get());
+            for (size_t i = begin; i < end; ++i) {
+                state.apply_delta(deltas[i], emit);
+            }
+            codes += state.direction_code();
+            begin = end;
+        }
+        profile_sink = (float)codes;
+    };
+    profile_run("apply_delta", ops, counters, counting, [&]() {
+        menu_state_t state;
+        replay(state, [](transition_t const&) {});
+    });
+    profile_run("apply_delta fixed", ops, counters, counting, [&]() {
+        fixed_menu_state_t state;
+        replay(state, [](transition_t const&) {});
+    });
+
+    /*
+        The same replay with a consumer of the transitions: one that only
+        counts them by kind, and one that records them the way a client
+        forwarding them would.
+    */
+    uint64_t transition_counts[8] = {};
+    profile_run("apply_delta count", ops, counters, counting, [&]() {
+        menu_state_t state;
+        replay(state, [&transition_counts](transition_t const& transition) {
+            transition_counts[(size_t)transition.kind & 7] += 1;
+        });
+    });
+    std::vector<transition_t> transitions;
+    transitions.reserve(ops);
+    profile_run("apply_delta record", ops, counters, counting, [&]() {
+        menu_state_t state;
+        transitions.resize(0);
+        replay(state, [&transitions](transition_t const& transition) {
+            transitions.push_back(transition);
+        });
+    });
+    uint64_t counted = 0;
+    for (uint64_t count : transition_counts) {
+        counted += count;
+    }
+    printf("%-18s %zu transitions per pass, %llu counted over both passes\n", "", transitions.size(), (unsigned long long)counted);
+    profile_input("input saturated", deltas.size(), 0);
+    profile_input("input paced", (uint64_t)polling_hz, polling_hz);
+    bool index_ok = profile_index(17, counters, counting);
+    counters.close();
+    bool history_ok = profile_history(tree.get(), deltas, stroke_ends, 1000000);
+    profile_layout("layout binary", 2, 6, polling_hz);
+    profile_layout("layout 8-ary", 8, 2, polling_hz);
+    profile_relayout("relayout menu", *tree, 5000, polling_hz);
+    menu_tree_t mixed;
+    for (int i = 0; i < 8; ++i) {
+        mixed.root[i] = profile_item(2, i);
+    }
+    profile_relayout("relayout mixed", mixed, 5000, polling_hz);
+    return index_ok && history_ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+#if defined(_WIN32)
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+        fprintf(stderr, "WSAStartup failed\n");
+        return 1;
+    }
+#endif
+    if (argc >= 4 && strcmp(argv[1], "serve") == 0) {
+        return serve(argv[2], argv[3]);
+    }
+    if (argc >= 4 && strcmp(argv[1], "bench") == 0) {
+        uint32_t clients = argc > 4 ? (uint32_t)strtoul(argv[4], nullptr, 10) : 1;
+        uint64_t delta_count = argc > 5 ? strtoull(argv[5], nullptr, 10) : 1000000;
+        uint32_t window = argc > 6 ? (uint32_t)strtoul(argv[6], nullptr, 10) : 1;
+        float polling_hz = argc > 7 ? strtof(argv[7], nullptr) : 1000.0f;
+        return bench(argv[2], argv[3], std::max<uint32_t>(clients, 1), delta_count, std::max<uint32_t>(window, 1), std::clamp(polling_hz, 125.0f, 8000.0f));
+    }
+    if (argc >= 3 && strcmp(argv[1], "profile") == 0) {
+        uint64_t delta_count = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1000000;
+        float polling_hz = argc > 4 ? strtof(argv[4], nullptr) : 1000.0f;
+        return profile(argv[2], std::max<uint64_t>(delta_count, 1), std::clamp(polling_hz, 125.0f, 8000.0f));
+    }
+    fprintf(stderr,
+        "usage: %s serve <socket path> <menu file>\n"
+        "       %s bench <socket path> <menu file> [clients] [deltas per client] [window] [polling hz]\n"
+        "       %s profile <menu file> [deltas] [polling hz]\n", argv[0], argv[0], argv[0]);
+    return 2;
+}
@@ -0,0 +1,174 @@
+// MenuEngineGesture.h : Synthetic pointer strokes aimed at the leaves of a menu tree.
+//
+
+#pragma once
+
+#include "MenuEngine.h"
+#include <vector>
+#include <stdint.h>
+#include <math.h>
+
+/*
+    Shape of the generated strokes. Durations are in seconds and distances
+    in menu units, the units apply_delta takes.
+
+    A stroke runs from the center through the waypoints of its leaf (see
+    leaf_index_t), which already lie past the lines that have to be
+    crossed, and then follow_through further along the last segment. Every
+    segment is a minimum-jerk movement, starting and ending at rest, whose
+    duration follows Fitts' law: fitts_a + fitts_b * log2(1 + distance /
+    target_width).
+
+    On top of the ideal path, drift is a slowly wandering offset (an
+    Ornstein-Uhlenbeck process with standard deviation drift and time
+    constant drift_time) and tremor is white jitter added to every sample.
+    With overshoot_probability a segment first overshoots its end by
+    overshoot times its length and then corrects back, with
+    hesitation_probability the hand rests for about hesitation_time before a
+    segment.
+
+    The position is sampled at polling_hz and reported as deltas quantized
+    to resolution, the size of one device count; samples that quantize to
+    no movement are not reported, like a real device. A resolution of 0
+    reports exact deltas.
+*/
+struct gesture_params_t {
+    float polling_hz = 1000.0f;
+    float resolution = 1.0f;
+    float fitts_a = 0.05f;
+    float fitts_b = 0.1f;
+    float target_width = 40.0f;
+    float follow_through = 80.0f;
+    float drift = 2.0f;
+    float drift_time = 0.1f;
+    float tremor = 0.3f;
+    float overshoot_probability = 0.1f;
+    float overshoot = 0.15f;
+    float hesitation_probability = 0.05f;
+    float hesitation_time = 0.2f;
+};
+
+/*
+    Deterministic for a given index, params and seed: the same calls produce
+    the same deltas on every run and platform that implements IEEE floats
+    the same way. Each generate call is one stroke starting from the center,
+    to be applied to a freshly reset menu_state_t, and returns the leaf it
+    aims at so that the selection can be scored.
+*/
+struct gesture_generator_t {
+    leaf_index_t const* index = nullptr;
+    gesture_params_t params;
+    uint64_t rng_state = 0;
+    float dt;
+    float drift_decay;
+    float drift_kick;
+
+    vec2 ideal_pos;
+    vec2 drift_pos;
+    vec2 reported_pos;
+    float phase;
+
+    void reset(leaf_index_t const& leaf_index, gesture_params_t const& gesture_params, uint64_t seed) {
+        index = &leaf_index;
+        params = gesture_params;
+        rng_state = seed;
+        dt = 1.0f / params.polling_hz;
+        drift_decay = dt / params.drift_time;
+        drift_kick = params.drift * sqrtf(2.0f * drift_decay);
+    }
+
+    uint64_t next_random() {
+        uint64_t z = (rng_state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    float uniform() {
+        return (float)(next_random() >> 40) * (1.0f / 16777216.0f);
+    }
+
+    /*
+        Irwin-Hall approximation of a standard normal variate, accurate to
+        well within what the noise model needs and much cheaper than
+        Box-Muller.
+    */
+    float normal() {
+        uint64_t r = next_random();
+        float sum = (float)(r & 0xffff) + (float)((r >> 16) & 0xffff) + (float)((r >> 32) & 0xffff) + (float)(r >> 48);
+        return (sum * (1.0f / 65536.0f) - 2.0f) * 1.7320508f;
+    }
+
+    void sample(std::vector<vec2>& deltas) {
+        drift_pos = drift_pos - drift_decay * drift_pos + drift_kick * vec2{normal(), normal()};
+        vec2 pos = ideal_pos + drift_pos + params.tremor * vec2{normal(), normal()};
+        if (params.resolution > 0) {
+            pos.x = roundf(pos.x / params.resolution) * params.resolution;
+            pos.y = roundf(pos.y / params.resolution) * params.resolution;
+        }
+        vec2 delta = pos - reported_pos;
+        if (delta.x != 0 || delta.y != 0) {
+            deltas.push_back(delta);
+            reported_pos = pos;
+        }
+    }
+
+    void rest(float duration, std::vector<vec2>& deltas) {
+        for (; phase < duration; phase += dt) {
+            sample(deltas);
+        }
+        phase -= duration;
+    }
+
+    void move(vec2 to, std::vector<vec2>& deltas) {
+        vec2 from = ideal_pos;
+        vec2 d = to - from;
+        float distance = sqrtf(d.x * d.x + d.y * d.y);
+        float duration = params.fitts_a + params.fitts_b * log2f(1.0f + distance / params.target_width);
+        float inv_duration = 1.0f / duration;
+        for (; phase < duration; phase += dt) {
+            float t = phase * inv_duration;
+            float s = t * t * t * (10.0f + t * (-15.0f + 6.0f * t));
+            ideal_pos = from + s * d;
+            sample(deltas);
+        }
+        phase -= duration;
+        ideal_pos = to;
+    }
+
+    void segment(vec2 to, std::vector<vec2>& deltas) {
+        if (uniform() < params.hesitation_probability) {
+            rest(params.hesitation_time * (0.5f + uniform()), deltas);
+        }
+        if (uniform() < params.overshoot_probability) {
+            move(to + params.overshoot * (to - ideal_pos), deltas);
+        }
+        move(to, deltas);
+    }
+
+    leaf_index_t::leaf_t const& generate(size_t leaf_number, std::vector<vec2>& deltas) {
+        leaf_index_t::leaf_t const& leaf = index->leaves[leaf_number];
+        ideal_pos = vec2{0, 0};
+        drift_pos = vec2{0, 0};
+        reported_pos = vec2{0, 0};
+        phase = 0;
+        vec2 from = ideal_pos;
+        vec2 direction = vec2{0, 0};
+        for (size_t i = leaf.waypoint_begin; i < leaf.waypoint_end; ++i) {
+            vec2 to = index->waypoints[i];
+            vec2 d = to - from;
+            float length = sqrtf(d.x * d.x + d.y * d.y);
+            if (length > 0) {
+                direction = (1.0f / length) * d;
+            }
+            segment(to, deltas);
+            from = to;
+        }
+        segment(ideal_pos + params.follow_through * direction, deltas);
+        return leaf;
+    }
+
+    leaf_index_t::leaf_t const& generate(std::vector<vec2>& deltas) {
+        return generate((size_t)(next_random() % index->leaves.size()), deltas);
+    }
+};
@@ -0,0 +1,148 @@
+// MenuEngineInput.h : Timestamped pointer input handed from an input thread to the state machine thread.
+//
+
+#pragma once
+
+#include "MenuEngine.h"
+#include "MenuEngineShm.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+enum class input_event_kind: uint32_t {
+    delta,
+    button_down,
+    button_up,
+};
+
+uint32_t const input_button_left = 0;
+uint32_t const input_button_right = 1;
+
+/*
+    time_ns is input_time_ns() when the input thread received the event.
+    delta is in device units and only meaningful for delta events, button
+    only for button events.
+
+    The input thread also samples the window the queue feeds, so that the
+    consumer sees it as it was when the event arrived and not when it gets
+    to drain the queue: foreground is whether the window was in the
+    foreground. For button presses, pointer_x and pointer_y are the
+    pointer position in its client coordinates and in_client is whether
+    that position was inside its client area of client_width by
+    client_height.
+*/
+struct input_event_t {
+    input_event_kind kind;
+    uint32_t button;
+    uint64_t time_ns;
+    vec2 delta;
+    int32_t pointer_x = 0;
+    int32_t pointer_y = 0;
+    int32_t client_width = 0;
+    int32_t client_height = 0;
+    bool foreground = false;
+    bool in_client = false;
+};
+
+inline uint64_t input_time_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+    The input thread only stamps events and pushes them here; the thread
+    that owns the menu state drains them whenever it gets to it, so a stall
+    on that thread delays the handling of input but neither its timestamps
+    nor its order. The ring is the same single-producer single-consumer ring
+    the daemon shares with its clients, used in process.
+
+    When the ring is full the producer does not block. Events that do not
+    fit wait in pending, in order, and are pushed ahead of the next event
+    once there is room again. Consecutive deltas are summed into one
+    pending delta, which keeps the pointer position exact and only loses
+    the timing in between, so pending only grows with button transitions.
+    Only an event that arrives while pending is full of transitions is
+    dropped. Both cases are counted in coalesced and dropped, which only
+    the producer writes and anyone may read. A producer that leaves events
+    pending has to call flush until it returns true, even if no more input
+    arrives.
+
+    reset must be called before the producer starts.
+*/
+template<uint32_t capacity>
+struct input_queue_t {
+    static uint32_t const pending_capacity = 64;
+
+    shm_ring_t<input_event_t, capacity> ring;
+    std::atomic<uint64_t> coalesced;
+    std::atomic<uint64_t> dropped;
+    input_event_t pending[pending_capacity];
+    uint32_t pending_count;
+
+    void reset() {
+        ring.head.store(0, std::memory_order_relaxed);
+        ring.tail.store(0, std::memory_order_relaxed);
+        coalesced.store(0, std::memory_order_relaxed);
+        dropped.store(0, std::memory_order_relaxed);
+        pending_count = 0;
+    }
+
+    /*
+        Producer side. Returns false if the event did not make it into the
+        ring as is, because it is pending or was dropped.
+    */
+    bool push(input_event_t const& event) {
+        if (flush() && ring.try_push(event)) {
+            return true;
+        }
+        return overflow(event);
+    }
+
+    /*
+        Pushes as many pending events as fit, also for a producer that has
+        no next event to push them ahead of. Returns false if some are
+        still pending.
+    */
+    bool flush() {
+        uint32_t n = 0;
+        while (n < pending_count && ring.try_push(pending[n])) {
+            n += 1;
+        }
+        if (n != 0) {
+            std::copy(pending + n, pending + pending_count, pending);
+            pending_count -= n;
+        }
+        return pending_count == 0;
+    }
+
+    bool overflow(input_event_t const& event) {
+        input_event_t* last = pending_count != 0 ? &pending[pending_count - 1] : nullptr;
+        if (event.kind == input_event_kind::delta && last && last->kind == input_event_kind::delta) {
+            vec2 delta = last->delta + event.delta;
+            *last = event;
+            last->delta = delta;
+        } else if (pending_count < pending_capacity) {
+            pending[pending_count] = event;
+            pending_count += 1;
+        } else {
+            dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        coalesced.store(coalesced.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /*
+        Consumer side: calls handle for every event in the ring, oldest
+        first, and returns how many there were.
+    */
+    template<typename handle_t>
+    uint32_t drain(handle_t&& handle) {
+        uint32_t n = ring.available();
+        for (uint32_t i = 0; i < n; ++i) {
+            handle(ring.peek(i));
+        }
+        ring.consume(n);
+        return n;
+    }
+};
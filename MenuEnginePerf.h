@@ -0,0 +1,111 @@
+// MenuEnginePerf.h : Hardware performance counters around benchmark runs.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+    Counts the calling thread's cycles, instructions, branch misses, L1 data
+    cache read misses and last-level cache misses between start and stop,
+    through perf_event_open on Linux. Every counter is opened on its own so
+    that a machine or VM that lacks some of them still reports the rest;
+    available[i] tells which ones count. open returns false when none do,
+    which is always the case on other systems, and callers then report
+    timings only.
+
+    The kernel multiplexes counters when there are more events than
+    hardware slots; values are scaled by the fraction of time each counter
+    was actually running.
+*/
+struct perf_counters_t {
+    static int const count = 5;
+
+    int fds[count];
+    bool available[count];
+    uint64_t values[count];
+
+    static char const* name(int i) {
+        static char const* const names[count] = {"cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses"};
+        return names[i];
+    }
+
+    bool open() {
+        bool any = false;
+        for (int i = 0; i < count; ++i) {
+            fds[i] = -1;
+            available[i] = false;
+            values[i] = 0;
+        }
+#if defined(__linux__)
+        uint32_t const types[count] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+        uint64_t const configs[count] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_MISSES,
+        };
+        for (int i = 0; i < count; ++i) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = types[i];
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            available[i] = fds[i] >= 0;
+            any = any || available[i];
+        }
+#endif
+        return any;
+    }
+
+    void start() {
+#if defined(__linux__)
+        for (int i = 0; i < count; ++i) {
+            if (available[i]) {
+                ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void stop() {
+#if defined(__linux__)
+        for (int i = 0; i < count; ++i) {
+            if (available[i]) {
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+        for (int i = 0; i < count; ++i) {
+            uint64_t data[3];
+            values[i] = 0;
+            if (available[i] && read(fds[i], data, sizeof(data)) == sizeof(data) && data[2] != 0) {
+                values[i] = data[2] == data[1] ? data[0] : (uint64_t)((double)data[0] * data[1] / data[2]);
+            }
+        }
+#endif
+    }
+
+    void close() {
+#if defined(__linux__)
+        for (int i = 0; i < count; ++i) {
+            if (available[i]) {
+                ::close(fds[i]);
+            }
+            available[i] = false;
+        }
+#endif
+    }
+};
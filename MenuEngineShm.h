@@ -0,0 +1,135 @@
+// MenuEngineShm.h : Shared-memory channel between the menu engine daemon and its clients.
+//
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+/*
+    A client talks to the daemon through two shared-memory rings: requests
+    carry pointer deltas and session begin/end from the client, responses
+    carry state updates back. Each ring has exactly one producer and one
+    consumer. head is only written by the producer and tail only by the
+    consumer; a record is published by the release store of head and retired
+    by the release store of tail, so neither side takes a lock or makes a
+    system call. Records are read in place through peek() and retired with
+    consume(), nothing is copied out of the ring.
+
+    The indices are free-running 32-bit counters, head - tail is the number
+    of records in the ring even after they wrap.
+
+    The daemon answers every batch of requests it drains with one state
+    record whose seq is that of the last request in the batch, and with one
+    selection record for every request after which a different item is
+    selected. A client that keeps at most shm_request_capacity requests in
+    flight can therefore never fill the response ring, which is twice as
+    large.
+
+    A daemon thread that finds the request ring empty for a while goes to
+    sleep on the control socket instead of spinning. It sets sleeping
+    before it checks the ring a last time, and a client checks sleeping
+    after every push; with a sequentially consistent fence on both sides
+    at least one of them sees the other. A client that sees sleeping set
+    clears it and writes an empty line to the control socket, which wakes
+    the daemon and gets no reply. A spurious empty line costs nothing, so
+    both sides may race on clearing the flag.
+*/
+template<typename record_t, uint32_t capacity>
+struct shm_ring_t {
+    static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+    alignas(64) record_t records[capacity];
+
+    bool try_push(record_t const& record) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == capacity) {
+            return false;
+        }
+        records[h & (capacity - 1)] = record;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    uint32_t available() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+    }
+
+    record_t const& peek(uint32_t i) const {
+        return records[(tail.load(std::memory_order_relaxed) + i) & (capacity - 1)];
+    }
+
+    void consume(uint32_t n) {
+        tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared-memory rings need address-free atomics");
+
+enum class shm_request_kind: uint32_t {
+    begin,
+    delta,
+    end,
+};
+
+struct shm_request_t {
+    shm_request_kind kind;
+    uint32_t seq;
+    float x;
+    float y;
+};
+
+enum class shm_response_kind: uint32_t {
+    state,
+    selection,
+};
+
+/*
+    depth and direction_code mean the same as in menu_engine_event, they are
+    0 outside of a session.
+*/
+struct shm_response_t {
+    shm_response_kind kind;
+    uint32_t seq;
+    uint32_t depth;
+    uint32_t reserved;
+    uint64_t direction_code;
+};
+
+uint32_t const shm_channel_magic = 0x4d454e55;
+uint32_t const shm_channel_version = 2;
+uint32_t const shm_request_capacity = 4096;
+uint32_t const shm_response_capacity = 2 * shm_request_capacity;
+uint32_t const shm_max_clients = 64;
+uint32_t const shm_max_control_line = 256;
+uint32_t const shm_max_publish_bytes = 4 << 20;
+
+struct shm_channel_t {
+    uint32_t magic;
+    uint32_t version;
+    shm_ring_t<shm_request_t, shm_request_capacity> requests;
+    shm_ring_t<shm_response_t, shm_response_capacity> responses;
+    alignas(64) std::atomic<uint32_t> sleeping;
+};
+
+/*
+    Control protocol on the socket, one line per message:
+
+        daemon -> client    channel <shared memory name> | busy
+        client -> daemon    publish <byte count>, followed by that many bytes of menu text
+        daemon -> client    ok | error <line>
+        client -> daemon    an empty line, to wake a sleeping daemon thread
+
+    The channel line is sent as soon as the client connects; the shared
+    memory is already initialized at that point. A daemon that already
+    serves shm_max_clients clients answers busy instead and closes the
+    socket. Closing the socket ends the client's session and frees its
+    channel.
+
+    A control line longer than shm_max_control_line bytes, or a publish of
+    more than shm_max_publish_bytes bytes, is answered with error 0 and
+    ends the session, since the daemon cannot tell where the next message
+    starts.
+*/
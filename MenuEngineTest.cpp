@@ -0,0 +1,875 @@
+// MenuEngineTest.cpp : Checks of the parts of the menu engine that do not need a window.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "MenuEngine.h"
+#include "MenuClip.h"
+#include "MenuEngineGesture.h"
+#include "MenuEngineInput.h"
+#include "MenuPaint.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+    Usage:
+
+        MenuEngineTest
+
+    Runs every check, prints the ones that fail and exits with 1 if any
+    did. The randomized checks use a fixed seed, so a failure reproduces.
+*/
+
+static int failures;
+
+static void check(bool ok, char const* what) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures += 1;
+    }
+}
+
+static uint64_t rng_state = 1;
+
+static uint64_t next_random() {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static float uniform(float low, float high) {
+    return low + (high - low) * (float)(next_random() >> 40) * (1.0f / 16777216.0f);
+}
+
+static bool near(vec2 a, vec2 b, float eps) {
+    return fabsf(a.x - b.x) <= eps && fabsf(a.y - b.y) <= eps;
+}
+
+static bool inside(clip_rect_t const& rect, vec2 p, float margin) {
+    return p.x >= rect.left + margin && p.x <= rect.right - margin && p.y >= rect.top + margin && p.y <= rect.bottom - margin;
+}
+
+/*
+    State machine.
+*/
+
+static int test_leaf_count;
+
+static menu_item_t test_leaf() {
+    test_leaf_count += 1;
+    return menu_item_t::leaf(L"leaf " + std::to_wstring(test_leaf_count));
+}
+
+/*
+    A leaf for depth 0, otherwise a submenu of width children, each of
+    depth - 1: binary for a width of 2, a ring for any other.
+*/
+static menu_item_t test_submenu(int width, int depth) {
+    if (depth == 0) {
+        return test_leaf();
+    }
+    std::vector<menu_item_t> children;
+    for (int i = 0; i < width; ++i) {
+        children.push_back(test_submenu(width, depth - 1));
+    }
+    return menu_item_t{L"submenu...", menu_item_t::submenu_t::make(std::move(children))};
+}
+
+/*
+    A tree that mixes leaves, binary submenus and rings of every size at
+    the top level and below each other.
+*/
+static std::unique_ptr<menu_tree_t> make_test_tree() {
+    auto tree = std::make_unique<menu_tree_t>();
+    tree->root[0] = test_submenu(2, 4);
+    tree->root[1] = test_leaf();
+    tree->root[2] = test_submenu(3, 1);
+    tree->root[3] = menu_item_t::branch(L"ring", test_submenu(2, 2), test_leaf(), test_submenu(4, 1), test_leaf(),
+        test_submenu(2, 1), test_leaf(), test_submenu(5, 1), test_leaf());
+    tree->root[4] = menu_item_t::branch(L"binary", test_submenu(6, 1), menu_item_t::branch(L"binary", test_leaf(), test_submenu(7, 1)));
+    tree->root[5] = test_submenu(8, 2);
+    tree->root[6] = menu_item_t::branch(L"ring", test_submenu(2, 3), test_leaf(), test_submenu(3, 2));
+    tree->root[7] = test_submenu(2, 1);
+    return tree;
+}
+
+/*
+    Strokes from gesture_generator_t aimed at random leaves of tree, back
+    to back; stroke_ends[i] is one past the last delta of stroke i.
+*/
+static void generate_strokes(leaf_index_t const& leaf_index, uint64_t seed, size_t stroke_count, std::vector<vec2>& deltas, std::vector<size_t>& stroke_ends) {
+    gesture_generator_t generator;
+    generator.reset(leaf_index, gesture_params_t{}, seed);
+    for (size_t i = 0; i < stroke_count; ++i) {
+        generator.generate(deltas);
+        stroke_ends.push_back(deltas.size());
+    }
+}
+
+/*
+    The global params start out as the default configuration, so
+    menu_state_t and fixed_menu_state_t have to agree on every field after
+    every delta.
+*/
+static void test_fixed_state_matches_runtime() {
+    std::unique_ptr<menu_tree_t> tree = make_test_tree();
+    leaf_index_t leaf_index;
+    leaf_index.build(*tree);
+    std::vector<vec2> deltas;
+    std::vector<size_t> stroke_ends;
+    generate_strokes(leaf_index, 1, 2000, deltas, stroke_ends);
+
+    menu_state_t runtime_state;
+    fixed_menu_state_t fixed_state;
+    size_t begin = 0;
+    size_t mismatches = 0;
+    size_t max_depth = 0;
+    for (size_t end : stroke_ends) {
+        runtime_state.reset(tree.get());
+        fixed_state.reset(tree.get());
+        for (size_t i = begin; i < end; ++i) {
+            runtime_state.apply_delta(deltas[i]);
+            fixed_state.apply_delta(deltas[i]);
+            mismatches += !same_menu_state(runtime_state, fixed_state);
+            max_depth = std::max(max_depth, runtime_state.branches.size());
+        }
+        begin = end;
+    }
+    check(max_depth >= 4, "the generated strokes open nested branches");
+    check(mismatches == 0, "menu_state_t and fixed_menu_state_t reach the same state after every delta");
+}
+
+/*
+    A session of generated strokes, each followed by its way back, recorded
+    in session_history_t. Restoring a snapshot, in random order, has to
+    give the state a fresh replay of the deltas before it reaches,
+    including the first and the last snapshot.
+*/
+static void test_session_history_restore() {
+    std::unique_ptr<menu_tree_t> tree = make_test_tree();
+    leaf_index_t leaf_index;
+    leaf_index.build(*tree);
+    std::vector<vec2> deltas;
+    std::vector<size_t> stroke_ends;
+    generate_strokes(leaf_index, 3, 200, deltas, stroke_ends);
+    std::vector<vec2> session;
+    size_t begin = 0;
+    for (size_t end : stroke_ends) {
+        for (size_t i = begin; i < end; ++i) {
+            session.push_back(deltas[i]);
+        }
+        for (size_t i = end; i-- > begin;) {
+            session.push_back(-deltas[i]);
+        }
+        begin = end;
+    }
+
+    menu_state_t state;
+    state.reset(tree.get());
+    session_history_t history;
+    history.reset(state);
+    size_t max_depth = 0;
+    for (vec2 delta : session) {
+        history.apply_delta(state, delta);
+        max_depth = std::max(max_depth, state.branches.size());
+    }
+    check(history.size() == session.size() + 1, "session_history_t keeps one snapshot per delta and one for the start");
+
+    std::vector<size_t> indices{0, history.size() - 1};
+    for (int k = 0; k < 64; ++k) {
+        indices.push_back((size_t)(next_random() % history.size()));
+    }
+    size_t mismatches = 0;
+    menu_state_t restored;
+    menu_state_t replayed;
+    for (size_t index : indices) {
+        history.restore(index, restored);
+        replayed.reset(tree.get());
+        for (size_t i = 0; i < index; ++i) {
+            replayed.apply_delta(session[i]);
+        }
+        mismatches += !same_menu_state(restored, replayed);
+    }
+    check(max_depth >= 4, "the recorded session opens nested branches");
+    check(mismatches == 0, "session_history_t restores the state a replay of the deltas before it reaches");
+}
+
+/*
+    A branch with a single child would open a ring with one spoke, so the
+    parser rejects it and points at the branch line.
+*/
+static void test_parse_menu_branch_sizes() {
+    std::wstring const valid =
+        L"a\n"
+        L"b\n"
+        L"  b1\n"
+        L"  b2\n"
+        L"c\n"
+        L"  c1\n"
+        L"  c2\n"
+        L"  c3\n"
+        L"d\ne\nf\ng\nh\n";
+    size_t error_line = 0;
+    std::unique_ptr<menu_tree_t> tree = parse_menu(valid, error_line);
+    check(tree && tree->root[1].submenu && tree->root[1].submenu->is_binary() && tree->root[2].is_ring(), "parse_menu accepts binary and ring branches");
+
+    std::wstring const single =
+        L"a\n"
+        L"b\n"
+        L"c\n"
+        L"  c1\n"
+        L"d\ne\nf\ng\nh\n";
+    error_line = 0;
+    check(!parse_menu(single, error_line) && error_line == 3, "parse_menu rejects a branch with a single child");
+}
+
+/*
+    Leaf index.
+*/
+
+static size_t count_leaves(menu_item_t const& item) {
+    if (!item.submenu) {
+        return 1;
+    }
+    size_t n = 0;
+    for (menu_item_t const& child : item.submenu->children) {
+        n += count_leaves(child);
+    }
+    return n;
+}
+
+/*
+    Every leaf has to map from its code and its item back to itself, and
+    replaying its waypoints alone, once as one delta per segment and once
+    in steps of at most one unit, has to select it.
+*/
+static bool leaf_round_trips(menu_tree_t* tree, leaf_index_t const& leaf_index, leaf_index_t::leaf_t const& leaf) {
+    if (leaf_index.find(leaf.code) != &leaf || leaf_index.find(leaf.menu_item_ptr) != &leaf) {
+        return false;
+    }
+    for (int stepped = 0; stepped < 2; ++stepped) {
+        menu_state_t state;
+        state.reset(tree);
+        vec2 from = vec2{0, 0};
+        for (size_t i = leaf.waypoint_begin; i < leaf.waypoint_end; ++i) {
+            vec2 d = leaf_index.waypoints[i] - from;
+            int steps = stepped ? std::max(1, (int)ceilf(sqrtf(d.x * d.x + d.y * d.y))) : 1;
+            for (int k = 0; k < steps; ++k) {
+                state.apply_delta((1.0f / (float)steps) * d);
+            }
+            from = leaf_index.waypoints[i];
+        }
+        if (state.selected_leaf_item() != leaf.menu_item_ptr || state.direction_code() != leaf.code) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_leaf_index_round_trip() {
+    std::unique_ptr<menu_tree_t> tree = make_test_tree();
+    leaf_index_t leaf_index;
+    check(leaf_index.build(*tree), "leaf_index_t indexes a shallow tree completely");
+    size_t leaf_count = 0;
+    for (menu_item_t const& item : tree->root) {
+        leaf_count += count_leaves(item);
+    }
+    check(leaf_index.leaves.size() == leaf_count, "leaf_index_t indexes every leaf");
+    size_t wrong = 0;
+    for (leaf_index_t::leaf_t const& leaf : leaf_index.leaves) {
+        wrong += !leaf_round_trips(tree.get(), leaf_index, leaf);
+    }
+    check(wrong == 0, "every leaf maps to its code and back, and its waypoints select it");
+    check(!leaf_index.find((direction_code_t)0) && !leaf_index.find(&tree->root[0]), "leaf_index_t finds no leaf for code 0 or for a branch");
+}
+
+/*
+    A chain of binary submenus down one sector, with a leaf on the left of
+    every level, runs out of direction code bits below depth 60: the 3
+    sector bits and one bit per level fill 63 bits there.
+*/
+static menu_item_t test_chain(int depth) {
+    if (depth == 0) {
+        return test_leaf();
+    }
+    return menu_item_t::branch(L"chain", test_leaf(), test_chain(depth - 1));
+}
+
+static void test_leaf_index_too_deep() {
+    auto tree = std::make_unique<menu_tree_t>();
+    tree->root[0] = test_chain(64);
+    for (int i = 1; i < 8; ++i) {
+        tree->root[i] = test_leaf();
+    }
+    leaf_index_t leaf_index;
+    check(!leaf_index.build(*tree), "leaf_index_t reports leaves too deep for a direction code");
+    size_t wrong = 0;
+    for (leaf_index_t::leaf_t const& leaf : leaf_index.leaves) {
+        wrong += direction_code_length(leaf.code) > direction_code_max_length || leaf_index.find(leaf.code) != &leaf;
+    }
+    check(leaf_index.leaves.size() == 7 + 60 && wrong == 0, "leaf_index_t still indexes every leaf that fits");
+}
+
+/*
+    Publishing.
+*/
+
+/*
+    Reader threads replay strokes against the tree they pinned while the
+    main thread publishes clones of it, every other time through
+    publish_if_current, which has to succeed on the tree it pinned and fail
+    once that tree has been replaced. Every replay has to select the same
+    item as on the original tree, and once all readers are gone every
+    retired tree has to be freed.
+*/
+static void test_rcu_publish_under_readers() {
+    std::unique_ptr<menu_tree_t> tree = make_test_tree();
+    leaf_index_t leaf_index;
+    leaf_index.build(*tree);
+    std::vector<vec2> deltas;
+    std::vector<size_t> stroke_ends;
+    generate_strokes(leaf_index, 2, 64, deltas, stroke_ends);
+    std::vector<direction_code_t> codes;
+    std::vector<std::wstring> descriptions;
+    fixed_menu_state_t reference;
+    size_t begin = 0;
+    for (size_t end : stroke_ends) {
+        reference.reset(tree.get());
+        for (size_t i = begin; i < end; ++i) {
+            reference.apply_delta(deltas[i]);
+        }
+        menu_item_t* item = reference.selected_leaf_item();
+        codes.push_back(reference.direction_code());
+        descriptions.push_back(item ? item->description : std::wstring());
+        begin = end;
+    }
+
+    menu_rcu_t rcu;
+    rcu.publish(tree->clone());
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> replays{0};
+    std::atomic<uint64_t> mismatches{0};
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < 3; ++r) {
+        readers.emplace_back([&, r]() {
+            menu_rcu_t::reader_t* reader = rcu.acquire_reader();
+            fixed_menu_state_t state;
+            size_t s = r;
+            do {
+                state.reset(rcu.pin(reader));
+                for (size_t i = s == 0 ? 0 : stroke_ends[s - 1]; i < stroke_ends[s]; ++i) {
+                    state.apply_delta(deltas[i]);
+                }
+                menu_item_t* item = state.selected_leaf_item();
+                if (state.direction_code() != codes[s] || (item ? item->description : std::wstring()) != descriptions[s]) {
+                    mismatches.fetch_add(1);
+                }
+                state.reset(nullptr);
+                rcu.unpin(reader);
+                replays.fetch_add(1);
+                s = (s + 1) % stroke_ends.size();
+            } while (!done.load(std::memory_order_relaxed));
+            rcu.release_reader(reader);
+        });
+    }
+    menu_rcu_t::reader_t* writer = rcu.acquire_reader();
+    size_t compare_failures = 0;
+    for (int i = 0; i < 4000; ++i) {
+        if (i % 2 == 0) {
+            rcu.publish(tree->clone());
+        } else {
+            menu_tree_t* pinned = rcu.pin(writer);
+            compare_failures += !rcu.publish_if_current(pinned, tree->clone());
+            compare_failures += rcu.publish_if_current(pinned, tree->clone());
+            rcu.unpin(writer);
+        }
+    }
+    rcu.release_reader(writer);
+    done.store(true);
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    rcu.collect();
+    check(replays.load() >= 3 && mismatches.load() == 0, "every replay on a pinned tree selects the same item as on the original");
+    check(compare_failures == 0, "publish_if_current succeeds exactly while the tree it compares against is current");
+    check(rcu.retired.size() == 0, "menu_rcu_t frees every retired tree once no reader is pinned");
+}
+
+/*
+    Clipping.
+*/
+
+static void test_clip_line_cases() {
+    clip_rect_t rect{0, 0, 100, 100};
+    vec2 a = vec2{10, 20};
+    vec2 b = vec2{90, 80};
+    check(clip_line(rect, a, b) && a.x == 10 && a.y == 20 && b.x == 90 && b.y == 80, "clip_line keeps a line inside the rect unchanged");
+
+    a = vec2{-50, 10};
+    b = vec2{-10, 90};
+    check(!clip_line(rect, a, b), "clip_line drops a line left of the rect");
+
+    a = vec2{50, 50};
+    b = vec2{150, 50};
+    check(clip_line(rect, a, b) && near(a, vec2{50, 50}, 0) && near(b, vec2{100, 50}, 1e-4f), "clip_line cuts a line leaving through the right edge");
+
+    a = vec2{-50, -50};
+    b = vec2{150, 150};
+    check(clip_line(rect, a, b) && near(a, vec2{0, 0}, 1e-4f) && near(b, vec2{100, 100}, 1e-4f), "clip_line cuts a diagonal at both corners");
+
+    a = vec2{150, 50};
+    b = vec2{-50, 50};
+    check(clip_line(rect, a, b) && near(a, vec2{100, 50}, 1e-4f) && near(b, vec2{0, 50}, 1e-4f), "clip_line keeps the direction of a line");
+
+    a = vec2{120, -10};
+    b = vec2{120, 110};
+    check(!clip_line(rect, a, b), "clip_line drops a vertical line right of the rect");
+
+    a = vec2{-30, 10};
+    b = vec2{10, -30};
+    check(!clip_line(rect, a, b), "clip_line drops a line that passes a corner outside the rect");
+
+    a = vec2{40, 40};
+    b = vec2{40, 40};
+    check(clip_line(rect, a, b) && a.x == 40 && b.y == 40, "clip_line keeps a point inside the rect");
+
+    a = vec2{-40, 40};
+    b = vec2{-40, 40};
+    check(!clip_line(rect, a, b), "clip_line drops a point outside the rect");
+}
+
+/*
+    Compares clip_line with sampling the segment: every sample well inside
+    the rect has to lie on the clipped part, and every sample well within
+    the clipped part has to lie inside the rect.
+*/
+static void test_clip_line_random() {
+    clip_rect_t rect{0, 0, 100, 100};
+    float const eps = 1e-3f;
+    int wrong = 0;
+    for (int n = 0; n < 100000; ++n) {
+        vec2 a = vec2{uniform(-200, 300), uniform(-200, 300)};
+        vec2 b = n % 8 == 0 ? vec2{a.x, uniform(-200, 300)} : vec2{uniform(-200, 300), uniform(-200, 300)};
+        vec2 ca = a;
+        vec2 cb = b;
+        bool kept = clip_line(rect, ca, cb);
+        vec2 d = b - a;
+        float length2 = d.x * d.x + d.y * d.y;
+        float ta = 0;
+        float tb = 1;
+        if (kept) {
+            if (!inside(rect, ca, -eps) || !inside(rect, cb, -eps)) {
+                wrong += 1;
+                continue;
+            }
+            if (length2 > 0) {
+                ta = ((ca.x - a.x) * d.x + (ca.y - a.y) * d.y) / length2;
+                tb = ((cb.x - a.x) * d.x + (cb.y - a.y) * d.y) / length2;
+            }
+            if (!near(ca, a + ta * d, 1e-2f) || !near(cb, a + tb * d, 1e-2f) || ta > tb + 1e-6f) {
+                wrong += 1;
+                continue;
+            }
+        }
+        float step_eps = length2 > 0 ? 0.01f / sqrtf(length2) : 0;
+        for (int i = 0; i <= 256; ++i) {
+            float t = (float)i / 256.0f;
+            vec2 p = a + t * d;
+            if (inside(rect, p, eps) && (!kept || t < ta - step_eps || t > tb + step_eps)) {
+                wrong += 1;
+                break;
+            }
+            if (kept && t > ta + step_eps && t < tb - step_eps && !inside(rect, p, -eps)) {
+                wrong += 1;
+                break;
+            }
+        }
+    }
+    check(wrong == 0, "clip_line agrees with sampling on random segments");
+}
+
+static void test_clip_paint_commands_random() {
+    clip_rect_t rect{-1, -1, 641, 481};
+    std::vector<paint_command_t> commands;
+    std::vector<paint_command_t> clipped;
+    int wrong = 0;
+    for (int n = 0; n < 1000; ++n) {
+        commands.resize(0);
+        size_t count = next_random() % 64;
+        uint32_t lines = 0;
+        uint32_t labels = 0;
+        for (size_t i = 0; i < count; ++i) {
+            vec2 a = vec2{uniform(-400, 1000), uniform(-400, 900)};
+            if (next_random() % 3 != 0) {
+                commands.push_back(paint_command_t{paint_kind::line, i, a, vec2{uniform(-400, 1000), uniform(-400, 900)}, nullptr, 0});
+                lines += 1;
+            } else {
+                commands.push_back(paint_command_t{paint_kind::label, i, a, a + vec2{uniform(0, 200), uniform(0, 30)}, nullptr, 7});
+                labels += 1;
+            }
+        }
+        clipped = commands;
+        clip_stats_t stats{};
+        size_t kept = clip_paint_commands(rect, clipped.data(), clipped.size(), stats);
+        if (stats.lines_submitted + stats.lines_culled != lines || stats.labels_submitted + stats.labels_culled != labels
+            || kept != stats.lines_submitted + stats.labels_submitted || stats.lines_clipped > stats.lines_submitted) {
+            wrong += 1;
+            continue;
+        }
+
+        size_t k = 0;
+        uint32_t clipped_lines = 0;
+        for (paint_command_t const& command : commands) {
+            bool expect_kept;
+            paint_command_t expected = command;
+            if (command.kind == paint_kind::line) {
+                expect_kept = clip_line(rect, expected.a, expected.b);
+                clipped_lines += expect_kept && (clip_outcode(rect, command.a) | clip_outcode(rect, command.b)) != 0;
+            } else {
+                expect_kept = (clip_outcode(rect, command.a) & clip_outcode(rect, command.b)) == 0;
+            }
+            if (!expect_kept) {
+                continue;
+            }
+            paint_command_t const& got = clipped[k];
+            k += 1;
+            if (k > kept || got.kind != expected.kind || got.style != expected.style || got.font != expected.font
+                || !near(got.a, expected.a, 0) || !near(got.b, expected.b, 0)) {
+                wrong += 1;
+                break;
+            }
+        }
+        if (k != kept || clipped_lines != stats.lines_clipped) {
+            wrong += 1;
+        }
+    }
+    check(wrong == 0, "clip_paint_commands keeps, clips and counts commands in order");
+}
+
+/*
+    Paint batching.
+*/
+
+/*
+    Records every op a paint_batch_t runs, with the points of a polyline
+    copied out, so that tests can compare the ops themselves and not only
+    their counts.
+*/
+struct paint_log_t {
+    struct entry_t {
+        paint_op_kind kind;
+        uintptr_t value;
+        std::vector<vec2> points;
+        paint_command_t const* command;
+    };
+
+    std::vector<entry_t> entries;
+
+    void pen(uintptr_t style) {
+        entries.push_back(entry_t{paint_op_kind::pen, style, {}, nullptr});
+    }
+
+    void text_color(uintptr_t style) {
+        entries.push_back(entry_t{paint_op_kind::text_color, style, {}, nullptr});
+    }
+
+    void font(uintptr_t font) {
+        entries.push_back(entry_t{paint_op_kind::font, font, {}, nullptr});
+    }
+
+    void polyline(vec2 const* points, uint32_t count) {
+        entries.push_back(entry_t{paint_op_kind::polyline, 0, std::vector<vec2>(points, points + count), nullptr});
+    }
+
+    void label(paint_command_t const& command) {
+        entries.push_back(entry_t{paint_op_kind::label, 0, {}, &command});
+    }
+};
+
+static paint_command_t paint_line(uintptr_t pen, vec2 a, vec2 b) {
+    return paint_command_t{paint_kind::line, pen, a, b, nullptr, 0};
+}
+
+static paint_command_t paint_label(uintptr_t font, uintptr_t color) {
+    return paint_command_t{paint_kind::label, color, vec2{0, 0}, vec2{10, 10}, nullptr, font};
+}
+
+static bool same_points(std::vector<vec2> const& points, std::vector<vec2> const& expected) {
+    if (points.size() != expected.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (!near(points[i], expected[i], 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_paint_batch_cases() {
+    paint_command_t const commands[] = {
+        paint_line(1, vec2{0, 0}, vec2{10, 0}),
+        paint_label(100, 7),
+        paint_line(2, vec2{5, 5}, vec2{6, 6}),
+        paint_line(1, vec2{10, 0}, vec2{10, 10}),
+        paint_line(1, vec2{20, 20}, vec2{10, 10}),
+        paint_label(200, 7),
+        paint_label(100, 8),
+    };
+    size_t const n = sizeof(commands) / sizeof(commands[0]);
+    paint_batch_t batch;
+
+    paint_recorder_t unbatched;
+    batch.translate(commands, n);
+    batch.run(unbatched);
+    check(unbatched.state_changes == 10 && unbatched.draw_calls == 7 && unbatched.points == 8, "paint_batch_t translate sets the state of every command");
+
+    paint_recorder_t batched;
+    batch.batch(commands, n);
+    batch.run(batched);
+    check(batched.state_changes == 7 && batched.draw_calls == 5 && batched.points == 6, "paint_batch_t batch counts the grouped ops");
+
+    paint_log_t log;
+    batch.run(log);
+    struct expected_t {
+        paint_op_kind kind;
+        uintptr_t value;
+        paint_command_t const* command;
+    };
+    expected_t const expected[] = {
+        {paint_op_kind::pen, 1, nullptr},
+        {paint_op_kind::polyline, 0, nullptr},
+        {paint_op_kind::pen, 2, nullptr},
+        {paint_op_kind::polyline, 0, nullptr},
+        {paint_op_kind::font, 100, nullptr},
+        {paint_op_kind::text_color, 7, nullptr},
+        {paint_op_kind::label, 0, &commands[1]},
+        {paint_op_kind::text_color, 8, nullptr},
+        {paint_op_kind::label, 0, &commands[6]},
+        {paint_op_kind::font, 200, nullptr},
+        {paint_op_kind::text_color, 7, nullptr},
+        {paint_op_kind::label, 0, &commands[5]},
+    };
+    bool ok = log.entries.size() == sizeof(expected) / sizeof(expected[0]);
+    for (size_t i = 0; ok && i < log.entries.size(); ++i) {
+        ok = log.entries[i].kind == expected[i].kind && log.entries[i].value == expected[i].value && log.entries[i].command == expected[i].command;
+    }
+    check(ok, "paint_batch_t batch draws lines by pen, then labels by font and color");
+    check(ok && same_points(log.entries[1].points, {vec2{0, 0}, vec2{10, 0}, vec2{10, 10}, vec2{20, 20}}) && same_points(log.entries[3].points, {vec2{5, 5}, vec2{6, 6}}),
+        "paint_batch_t batch joins lines that continue from either end");
+
+    batch.batch(commands, 0);
+    check(batch.ops.empty() && batch.points.empty(), "paint_batch_t batch of no commands has no ops");
+}
+
+/*
+    Checks batch against what its comment promises, on random commands
+    drawn from a few pens, fonts and colors with endpoints on a small grid,
+    so that many lines join: every line drawn once in its own pen, all
+    lines before all labels, groups in order of first appearance with
+    their commands in order, every label in its own font and color, and no
+    state set to the value it already has.
+*/
+static void test_paint_batch_random() {
+    std::vector<paint_command_t> commands;
+    paint_batch_t batch;
+    paint_log_t log;
+    int wrong = 0;
+    for (int n = 0; n < 2000 && wrong == 0; ++n) {
+        commands.resize(0);
+        size_t count = next_random() % 48;
+        for (size_t i = 0; i < count; ++i) {
+            if (next_random() % 4 != 0) {
+                vec2 a = vec2{(float)(next_random() % 4), (float)(next_random() % 4)};
+                vec2 b = vec2{(float)(next_random() % 4), (float)(next_random() % 4)};
+                commands.push_back(paint_line(1 + next_random() % 3, a, b));
+            } else {
+                commands.push_back(paint_label(100 + next_random() % 2, 7 + next_random() % 3));
+            }
+        }
+
+        std::vector<uintptr_t> pens;
+        std::vector<uintptr_t> fonts;
+        std::vector<uintptr_t> colors;
+        for (paint_command_t const& command : commands) {
+            if (command.kind == paint_kind::line) {
+                paint_batch_t::rank(pens, command.style);
+            } else {
+                paint_batch_t::rank(fonts, command.font);
+                paint_batch_t::rank(colors, command.style);
+            }
+        }
+        std::vector<paint_command_t const*> expected_lines;
+        for (uintptr_t pen : pens) {
+            for (paint_command_t const& command : commands) {
+                if (command.kind == paint_kind::line && command.style == pen) {
+                    expected_lines.push_back(&command);
+                }
+            }
+        }
+        std::vector<paint_command_t const*> expected_labels;
+        for (uintptr_t font : fonts) {
+            for (uintptr_t color : colors) {
+                for (paint_command_t const& command : commands) {
+                    if (command.kind == paint_kind::label && command.font == font && command.style == color) {
+                        expected_labels.push_back(&command);
+                    }
+                }
+            }
+        }
+
+        batch.batch(commands.data(), commands.size());
+        log.entries.resize(0);
+        batch.run(log);
+
+        bool have_pen = false;
+        bool have_color = false;
+        bool have_font = false;
+        uintptr_t pen = 0;
+        uintptr_t color = 0;
+        uintptr_t font = 0;
+        uint32_t pen_changes = 0;
+        uint32_t font_changes = 0;
+        size_t next_line = 0;
+        size_t next_label = 0;
+        for (paint_log_t::entry_t const& entry : log.entries) {
+            switch (entry.kind) {
+            case paint_op_kind::pen:
+                wrong += have_pen && pen == entry.value;
+                have_pen = true;
+                pen = entry.value;
+                pen_changes += 1;
+                break;
+            case paint_op_kind::text_color:
+                wrong += have_color && color == entry.value;
+                have_color = true;
+                color = entry.value;
+                break;
+            case paint_op_kind::font:
+                wrong += have_font && font == entry.value;
+                have_font = true;
+                font = entry.value;
+                font_changes += 1;
+                break;
+            case paint_op_kind::polyline:
+                wrong += !have_pen || next_label != 0 || entry.points.size() < 2;
+                for (size_t i = 1; i < entry.points.size(); ++i) {
+                    if (next_line == expected_lines.size()) {
+                        wrong += 1;
+                        break;
+                    }
+                    paint_command_t const& line = *expected_lines[next_line];
+                    next_line += 1;
+                    vec2 a = entry.points[i - 1];
+                    vec2 b = entry.points[i];
+                    bool same_line = (near(a, line.a, 0) && near(b, line.b, 0)) || (near(a, line.b, 0) && near(b, line.a, 0));
+                    wrong += !same_line || line.style != pen;
+                }
+                break;
+            case paint_op_kind::label:
+                if (next_label == expected_labels.size() || entry.command != expected_labels[next_label]) {
+                    wrong += 1;
+                    break;
+                }
+                next_label += 1;
+                wrong += !have_font || !have_color || entry.command->font != font || entry.command->style != color;
+                break;
+            }
+        }
+        wrong += next_line != expected_lines.size() || next_label != expected_labels.size();
+        wrong += pen_changes != pens.size() || font_changes != fonts.size();
+    }
+    check(wrong == 0, "paint_batch_t batch draws every command once, grouped and in order, with minimal state changes");
+}
+
+/*
+    Input queue.
+*/
+
+static input_event_t input_delta(float x) {
+    return input_event_t{input_event_kind::delta, 0, 0, vec2{x, 0}};
+}
+
+static input_event_t input_button(input_event_kind kind) {
+    return input_event_t{kind, input_button_left, 0, vec2{0, 0}};
+}
+
+static input_queue_t<8> test_queue;
+
+/*
+    With nobody draining, a full ring has to keep button transitions in
+    order between the deltas around them, sum only deltas that follow each
+    other, and drop only once pending is full of transitions.
+*/
+static void test_input_queue_overflow() {
+    input_queue_t<8>& queue = test_queue;
+    queue.reset();
+    for (int i = 0; i < 8; ++i) {
+        check(queue.push(input_delta(1)), "input_queue_t pushes while the ring has room");
+    }
+    queue.push(input_delta(1));
+    queue.push(input_button(input_event_kind::button_down));
+    queue.push(input_delta(2));
+    queue.push(input_delta(3));
+    queue.push(input_button(input_event_kind::button_up));
+    queue.push(input_delta(4));
+    check(queue.coalesced.load() == 6 && queue.dropped.load() == 0 && queue.pending_count == 5, "input_queue_t keeps what does not fit pending");
+
+    std::vector<input_event_t> events;
+    for (int round = 0; round < 4; ++round) {
+        queue.drain([&events](input_event_t const& event) {
+            events.push_back(event);
+        });
+        queue.flush();
+    }
+    bool ok = events.size() == 13 && queue.pending_count == 0;
+    for (size_t i = 0; ok && i < 8; ++i) {
+        ok = events[i].kind == input_event_kind::delta && events[i].delta.x == 1;
+    }
+    ok = ok && events[8].kind == input_event_kind::delta && events[8].delta.x == 1;
+    ok = ok && events[9].kind == input_event_kind::button_down;
+    ok = ok && events[10].kind == input_event_kind::delta && events[10].delta.x == 5;
+    ok = ok && events[11].kind == input_event_kind::button_up;
+    ok = ok && events[12].kind == input_event_kind::delta && events[12].delta.x == 4;
+    check(ok, "input_queue_t delivers pending events in order once there is room");
+
+    queue.reset();
+    for (int i = 0; i < 8; ++i) {
+        queue.push(input_delta(1));
+    }
+    for (uint32_t i = 0; i < input_queue_t<8>::pending_capacity; ++i) {
+        queue.push(input_button(i % 2 == 0 ? input_event_kind::button_down : input_event_kind::button_up));
+    }
+    check(queue.dropped.load() == 0, "input_queue_t keeps transitions until pending is full");
+    queue.push(input_delta(1));
+    check(queue.dropped.load() == 1, "input_queue_t drops an event only once pending is full");
+}
+
+int main() {
+    test_fixed_state_matches_runtime();
+    test_session_history_restore();
+    test_parse_menu_branch_sizes();
+    test_leaf_index_round_trip();
+    test_leaf_index_too_deep();
+    test_rcu_publish_under_readers();
+    test_clip_line_cases();
+    test_clip_line_random();
+    test_clip_paint_commands_random();
+    test_paint_batch_cases();
+    test_paint_batch_random();
+    test_input_queue_overflow();
+    if (failures != 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
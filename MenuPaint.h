@@ -0,0 +1,217 @@
+// MenuPaint.h : Batching of paint commands into few state changes and draw calls, independent of the window system.
+//
+
+#pragma once
+
+#include "MenuClip.h"
+#include <algorithm>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    A paint batch turns a list of paint commands into ops for a backend:
+    state changes (pen, text color, font) and draw calls (polyline, label).
+    A backend is any type with these member functions, called in order:
+
+        void pen(uintptr_t style);
+        void text_color(uintptr_t style);
+        void font(uintptr_t font);
+        void polyline(vec2 const* points, uint32_t count);
+        void label(paint_command_t const& command);
+
+    translate produces the ops one command at a time, the way the commands
+    would be drawn directly: a pen before every line, a text color before
+    every label and a font whenever it differs from the last label's. batch
+    draws all lines before all labels, groups lines by pen and labels by
+    font and then text color, each in the order the values first appear,
+    sets only the state that actually changes and joins lines that continue
+    where the previous one ended into one polyline. Within a group the
+    commands keep their order, so lines in one pen still overlap the way
+    they were recorded and labels still end up on top of the geometry.
+*/
+enum class paint_op_kind: uint8_t {
+    pen,
+    text_color,
+    font,
+    polyline,
+    label,
+};
+
+/*
+    value is the state for pen, text_color and font. A polyline is count
+    points of paint_batch_t::points starting at first.
+*/
+struct paint_op_t {
+    paint_op_kind kind;
+    uintptr_t value;
+    uint32_t first;
+    uint32_t count;
+    paint_command_t const* command;
+};
+
+/*
+    Counts what a backend would be asked to do, for checking the batching
+    and for reporting it per frame.
+*/
+struct paint_recorder_t {
+    uint32_t state_changes = 0;
+    uint32_t draw_calls = 0;
+    uint32_t points = 0;
+
+    void pen(uintptr_t) {
+        state_changes += 1;
+    }
+
+    void text_color(uintptr_t) {
+        state_changes += 1;
+    }
+
+    void font(uintptr_t) {
+        state_changes += 1;
+    }
+
+    void polyline(vec2 const*, uint32_t count) {
+        draw_calls += 1;
+        points += count;
+    }
+
+    void label(paint_command_t const&) {
+        draw_calls += 1;
+    }
+};
+
+struct paint_batch_t {
+    std::vector<paint_op_t> ops;
+    std::vector<vec2> points;
+
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> order;
+    std::vector<uintptr_t> seen_pens;
+    std::vector<uintptr_t> seen_colors;
+    std::vector<uintptr_t> seen_fonts;
+
+    void state(paint_op_kind kind, uintptr_t value) {
+        ops.push_back(paint_op_t{kind, value, 0, 0, nullptr});
+    }
+
+    void line(vec2 a, vec2 b) {
+        ops.push_back(paint_op_t{paint_op_kind::polyline, 0, (uint32_t)points.size(), 2, nullptr});
+        points.push_back(a);
+        points.push_back(b);
+    }
+
+    void translate(paint_command_t const* commands, size_t n) {
+        ops.resize(0);
+        points.resize(0);
+        bool have_font = false;
+        uintptr_t font = 0;
+        for (size_t i = 0; i < n; ++i) {
+            paint_command_t const& command = commands[i];
+            if (command.kind == paint_kind::line) {
+                state(paint_op_kind::pen, command.style);
+                line(command.a, command.b);
+            } else {
+                if (!have_font || font != command.font) {
+                    have_font = true;
+                    font = command.font;
+                    state(paint_op_kind::font, font);
+                }
+                state(paint_op_kind::text_color, command.style);
+                ops.push_back(paint_op_t{paint_op_kind::label, 0, 0, 0, &command});
+            }
+        }
+    }
+
+    static uint64_t rank(std::vector<uintptr_t>& seen, uintptr_t value) {
+        size_t i = std::find(seen.begin(), seen.end(), value) - seen.begin();
+        if (i == seen.size()) {
+            seen.push_back(value);
+        }
+        return i;
+    }
+
+    void batch(paint_command_t const* commands, size_t n) {
+        ops.resize(0);
+        points.resize(0);
+        keys.resize(n);
+        order.resize(n);
+        seen_pens.resize(0);
+        seen_colors.resize(0);
+        seen_fonts.resize(0);
+        for (size_t i = 0; i < n; ++i) {
+            paint_command_t const& command = commands[i];
+            if (command.kind == paint_kind::line) {
+                keys[i] = rank(seen_pens, command.style) << 40;
+            } else {
+                keys[i] = (uint64_t)1 << 63 | rank(seen_fonts, command.font) << 40 | rank(seen_colors, command.style) << 20;
+            }
+            order[i] = (uint32_t)i;
+        }
+        std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+            return keys[a] < keys[b];
+        });
+
+        bool have_pen = false;
+        bool have_color = false;
+        bool have_font = false;
+        uintptr_t pen = 0;
+        uintptr_t color = 0;
+        uintptr_t font = 0;
+        for (uint32_t i : order) {
+            paint_command_t const& command = commands[i];
+            if (command.kind == paint_kind::line) {
+                if (!have_pen || pen != command.style) {
+                    have_pen = true;
+                    pen = command.style;
+                    state(paint_op_kind::pen, pen);
+                }
+                paint_op_t* last = ops.back().kind == paint_op_kind::polyline ? &ops.back() : nullptr;
+                if (last && points.back().x == command.a.x && points.back().y == command.a.y) {
+                    points.push_back(command.b);
+                    last->count += 1;
+                } else if (last && points.back().x == command.b.x && points.back().y == command.b.y) {
+                    points.push_back(command.a);
+                    last->count += 1;
+                } else {
+                    line(command.a, command.b);
+                }
+            } else {
+                if (!have_font || font != command.font) {
+                    have_font = true;
+                    font = command.font;
+                    state(paint_op_kind::font, font);
+                }
+                if (!have_color || color != command.style) {
+                    have_color = true;
+                    color = command.style;
+                    state(paint_op_kind::text_color, color);
+                }
+                ops.push_back(paint_op_t{paint_op_kind::label, 0, 0, 0, &command});
+            }
+        }
+    }
+
+    template<typename backend_t>
+    void run(backend_t& backend) const {
+        for (paint_op_t const& op : ops) {
+            switch (op.kind) {
+            case paint_op_kind::pen:
+                backend.pen(op.value);
+                break;
+            case paint_op_kind::text_color:
+                backend.text_color(op.value);
+                break;
+            case paint_op_kind::font:
+                backend.font(op.value);
+                break;
+            case paint_op_kind::polyline:
+                backend.polyline(points.data() + op.first, op.count);
+                break;
+            case paint_op_kind::label:
+                backend.label(*op.command);
+                break;
+            }
+        }
+    }
+};
@@ -0,0 +1,280 @@
+// MenuScene.h : Paint commands that draw a menu state, independent of the window system.
+//
+
+#pragma once
+
+#include "MenuClip.h"
+#include "MenuEngine.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+    Menu units per window pixel, for drawing and for scaling pointer
+    deltas back into menu units.
+*/
+float const display_scale = 0.2f;
+
+/*
+    Where a label is placed relative to its anchor, in multiples of its
+    size, for each rotor: labels sit outside the menu in the direction
+    they belong to.
+*/
+vec2 const text_delta_table[8] = {
+    vec2{ 0.0f, -0.5f},
+    vec2{ 0.0f,  0.0f},
+    vec2{-0.5f,  0.0f},
+    vec2{-1.0f,  0.0f},
+    vec2{-1.0f, -0.5f},
+    vec2{-1.0f, -1.0f},
+    vec2{-0.5f, -1.0f},
+    vec2{ 0.0f, -1.0f},
+};
+
+/*
+    The pens, text colors and font the scene is drawn with, opaque values
+    that end up in paint_command_t::style and paint_command_t::font.
+*/
+struct menu_scene_style_t {
+    uintptr_t pen_passive;
+    uintptr_t pen_active;
+    uintptr_t pen_current;
+    uintptr_t color_waiting;
+    uintptr_t color_selected;
+    uintptr_t color_disabled;
+    uintptr_t font_label;
+};
+
+/*
+    Appends the commands that draw state with the menu center at
+    center_x, center_y in window pixels: the top-level sectors, every open
+    branch with its edges and labels, and the path of the pointer. measure
+    returns the size in pixels of a label in font_label as a vec2.
+
+    The geometry reads the global params, the same source menu_state_t
+    reads. It is not templated on a params source like basic_menu_state_t:
+    only the runtime configuration is ever drawn, and fixed_menu_state_t
+    is for hosts that do not draw the menu themselves.
+*/
+template<typename measure_t>
+void menu_scene_commands(menu_state_t const& state, int center_x, int center_y, menu_scene_style_t const& style, measure_t&& measure,
+    std::vector<paint_command_t>& commands) {
+    auto to_screen = [&](vec2 a, int& ax, int& ay) {
+        ax = center_x + (int)(display_scale * a.x);
+        ay = center_y + (int)(display_scale * a.y);
+    };
+    uintptr_t pen = style.pen_passive;
+    uintptr_t text_color = style.color_waiting;
+    auto line = [&](vec2 a, vec2 b) {
+        int ax, ay, bx, by;
+        to_screen(a, ax, ay);
+        to_screen(b, bx, by);
+        commands.push_back(paint_command_t{paint_kind::line, pen, vec2{(float)ax, (float)ay}, vec2{(float)bx, (float)by}, nullptr, 0});
+    };
+    auto text = [&](vec2 base, vec2 delta, std::wstring const& str) {
+        vec2 size = measure(str);
+        int cx = (int)size.x;
+        int cy = (int)size.y;
+        delta.x *= (float)cx;
+        delta.y *= (float)cy;
+        vec2 a = base;
+        int ax, ay;
+        to_screen(a, ax, ay);
+        ax += (int)delta.x;
+        ay += (int)delta.y;
+        commands.push_back(paint_command_t{paint_kind::label, text_color, vec2{(float)ax, (float)ay}, vec2{(float)(ax + cx), (float)(ay + cy)}, &str, style.font_label});
+    };
+    if (state.branches.size() == 0) {
+        pen = style.pen_active;
+    } else {
+        pen = style.pen_passive;
+    }
+    for (int i = 0; i < 8; ++i) {
+        vec2 p = params.initial_radius * vec2{1, tan_pi_8};
+        vec2 gpa = rotor(i) % p;
+        vec2 gpb = rotor(i) % ~p;
+        line(gpa, gpb);
+        vec2 t = vec2{params.initial_radius + params.branch_label_height_offset, 0};
+        vec2 gt = rotor(i) % t;
+        uintptr_t t_color = style.color_waiting;
+        if (state.branches.size() >= 1) {
+            if (+state.branches[0].rot == i) {
+                t_color = style.color_selected;
+            } else {
+                t_color = style.color_disabled;
+            }
+        }
+        if (t_color != style.color_selected) {
+            text_color = t_color;
+            text(gt, text_delta_table[i], state.tree->root[i].description);
+        }
+    }
+    for (size_t i = 0; i < state.branches.size(); ++i) {
+        menu_state_t::branch_t const& branch = state.branches[i];
+        bool is_active = i == state.branches.size() - 1;
+        if (branch.menu_item_ptr->is_ring()) {
+            menu_item_t::submenu_t const& submenu = *branch.menu_item_ptr->submenu;
+            nary_layout_t const& layout = nary_layouts[submenu.children.size()];
+            vec2 center = branch.origin + branch.rot % vec2{params.initial_radius, 0};
+            if (is_active && !branch.top_active) {
+                vec2 p = vec2{0, params.initial_radius * tan_pi_8};
+                pen = style.pen_active;
+                line(center + branch.rot % p, center + branch.rot % -p);
+            }
+            if (is_active && branch.top_active) {
+                pen = style.pen_active;
+            } else {
+                pen = style.pen_passive;
+            }
+            for (size_t k = 0; k < submenu.children.size(); ++k) {
+                rotor child_rot = branch.rot + rotor(layout.offsets[k]);
+                vec2 p = params.initial_radius * vec2{1, tan_pi_8};
+                line(center + child_rot % p, center + child_rot % ~p);
+                vec2 t = vec2{params.initial_radius + params.branch_label_height_offset, 0};
+                vec2 gt = center + child_rot % t;
+                uintptr_t t_color = style.color_waiting;
+                if (state.branches.size() > (i + 1)) {
+                    if (state.branches[i + 1].menu_item_ptr == &submenu.children[k]) {
+                        t_color = style.color_selected;
+                    } else {
+                        t_color = style.color_disabled;
+                    }
+                }
+                if (t_color != style.color_selected) {
+                    text_color = t_color;
+                    text(gt, text_delta_table[+child_rot], submenu.children[k].description);
+                }
+            }
+        } else if (branch.menu_item_ptr->submenu) {
+            menu_item_t::submenu_t const& submenu = *branch.menu_item_ptr->submenu;
+            /*
+                px = left_slope * py
+
+                py = base_width + sector_slope * px
+                py = base_width / (1 - sector_slope * base_slope)
+
+                py = - base_width - sector_slope * px
+                py = - base_width / (1 + sector_slope * base_slope)
+
+
+
+                px = base_slope * py + trigger
+
+                py = bot_offset + sector_slope * px
+                py = (bot_offset + sector_slope * trigger) / (1 - sector_slope * base_slope)
+
+                py = - top_offset - sector_slope * px
+                py = - (top_offset + sector_slope * trigger) / (1 + sector_slope * base_slope)
+            */
+            vec2 pos = ~branch.rot % (state.global_pos - branch.origin);
+            float bot_offset = branch.bot_offset;
+            if (!branch.bot_active) {
+                float y_distance = bot_offset + params.sector_edge_slope * pos.x - pos.y;
+                if (y_distance < bot_offset) {
+                    bot_offset += bot_offset - y_distance;
+                }
+            }
+            float top_offset = branch.top_offset;
+            if (!branch.top_active) {
+                float y_distance = top_offset + params.sector_edge_slope * pos.x + pos.y;
+                if (y_distance < top_offset) {
+                    top_offset += top_offset - y_distance;
+                }
+            }
+            float a = bot_offset / (1 - branch.base_slope * params.sector_edge_slope);
+            float b = -top_offset / (1 + branch.base_slope * params.sector_edge_slope);
+            vec2 pa = vec2{branch.base_slope * a, a};
+            vec2 pb = vec2{branch.base_slope * b, b};
+            vec2 qa = vec2{0, bot_offset} + (10 * params.initial_radius) * vec2 { 1, params.sector_edge_slope };
+            vec2 qb = vec2{0, -top_offset} + (10 * params.initial_radius) * vec2 { 1, -params.sector_edge_slope };
+            vec2 gpa = branch.origin + branch.rot % pa;
+            vec2 gpb = branch.origin + branch.rot % pb;
+            vec2 gqa = branch.origin + branch.rot % qa;
+            vec2 gqb = branch.origin + branch.rot % qb;
+            if (is_active) {
+                pen = style.pen_active;
+            }
+            line(gpa, gpb);
+            if (is_active && branch.bot_active) {
+                pen = style.pen_active;
+            } else {
+                pen = style.pen_passive;
+            }
+            line(gqa, gpa);
+            if (is_active && branch.top_active) {
+                pen = style.pen_active;
+            } else {
+                pen = style.pen_passive;
+            }
+            line(gpb, gqb);
+            if (is_active && (!branch.top_active || !branch.bot_active)) {
+                float at = (bot_offset + params.sector_edge_slope * branch.trigger_offset) / (1 - branch.base_slope * params.sector_edge_slope);
+                float bt = (-top_offset - params.sector_edge_slope * branch.trigger_offset) / (1 + branch.base_slope * params.sector_edge_slope);
+                vec2 pat = vec2{branch.base_slope * at + branch.trigger_offset, at};
+                vec2 pbt = vec2{branch.base_slope * bt + branch.trigger_offset, bt};
+                vec2 gpat = branch.origin + branch.rot % pat;
+                vec2 gpbt = branch.origin + branch.rot % pbt;
+                pen = style.pen_active;
+                line(gpat, gpbt);
+            }
+            vec2 tdx = params.branch_label_height_offset * vec2{branch.base_slope, 1};
+            vec2 tdya = params.branch_label_length_offset * vec2{1, params.sector_edge_slope};
+            vec2 tdyb = params.branch_label_length_offset * vec2{1, -params.sector_edge_slope};
+            vec2 ta = pa + tdx + tdya;
+            vec2 tb = pb - tdx + tdyb;
+            vec2 gta = branch.origin + branch.rot % ta;
+            vec2 gtb = branch.origin + branch.rot % tb;
+            uintptr_t color_ta = style.color_disabled;
+            uintptr_t color_tb = style.color_disabled;
+            if (state.branches.size() > (i + 1)) {
+                rotor delta_rot = ~state.branches[i].rot + state.branches[i + 1].rot;
+                if (+delta_rot == 2) {
+                    color_ta = style.color_selected;
+                } else if (+delta_rot == 6) {
+                    color_tb = style.color_selected;
+                }
+            } else {
+                color_ta = style.color_waiting;
+                color_tb = style.color_waiting;
+            }
+            if (color_ta != style.color_selected) {
+                vec2 tadelta = text_delta_table[+(state.branches[i].rot + (rotor)1)];
+                text_color = color_ta;
+                text(gta, tadelta, submenu.children[1].description);
+            }
+            if (color_tb != style.color_selected) {
+                vec2 tbdelta = text_delta_table[+(state.branches[i].rot + (rotor)7)];
+                text_color = color_tb;
+                text(gtb, tbdelta, submenu.children[0].description);
+            }
+        } else {
+            float a = params.leaf_base_offset / (1 - branch.base_slope * params.sector_edge_slope);
+            float b = -params.leaf_base_offset / (1 + branch.base_slope * params.sector_edge_slope);
+            vec2 pa = vec2{branch.base_slope * a, a};
+            vec2 pb = vec2{branch.base_slope * b, b};
+            vec2 q = vec2{params.leaf_height, 0};
+            vec2 gpa = branch.origin + branch.rot % pa;
+            vec2 gpb = branch.origin + branch.rot % pb;
+            vec2 gq = branch.origin + branch.rot % q;
+            pen = style.pen_active;
+            line(gpa, gpb);
+            line(gpb, gq);
+            line(gq, gpa);
+        }
+        vec2 t = vec2{params.branch_label_height_offset, 0};
+        vec2 gt = branch.origin + branch.rot % t;
+        vec2 tdelta = text_delta_table[+state.branches[i].rot];
+        text_color = style.color_selected;
+        text(gt, tdelta, branch.menu_item_ptr->description);
+    }
+    pen = style.pen_current;
+    if (state.branches.size() == 0) {
+        line(vec2{0,0}, state.global_pos);
+    } else {
+        line(vec2{0,0}, state.branches[0].origin);
+        for (size_t i = 0; i < state.branches.size() - 1; ++i) {
+            line(state.branches[i].origin, state.branches[i + 1].origin);
+        }
+        line(state.branches.back().origin, state.global_pos);
+    }
+}